@@ -89,6 +89,10 @@ public:
 		bool isStratum;
 	} node_t;
 
+	// how long to wait before trying the node / pool again after an error, and how often the
+	// mining loops check whether they should exit.
+	enum { c_retrySeconds = 5, c_watchMs = 250 };
+
 
 	/*-----------------------------------------------------------------------------------
 	* constructor
@@ -200,6 +204,7 @@ public:
 		else if ((arg == "--cl-work-multiplier" || arg == "--cuda-grid-size")  && i + 1 < argc)
 			try {
 				m_workSizeMultiplier = stol(argv[++i]);
+				m_workSizeGiven = true;
 			}
 			catch (...)
 			{
@@ -209,12 +214,24 @@ public:
 		else if ((arg == "--cl-local-work" || arg == "--cuda-block-size") && i + 1 < argc)
 			try {
 				m_localWorkSize = stol(argv[++i]);
+				m_workSizeGiven = true;
 			}
 			catch (...)
 			{
 				LogS << "Invalid " << arg << " option: " << argv[i];
 				exit(-1);
 			}
+		else if (arg == "--cl-hashes-per-item" && i + 1 < argc)
+			try {
+				m_hashesPerItem = stol(argv[++i]);
+			}
+			catch (...)
+			{
+				LogS << "Invalid " << arg << " option: " << argv[i];
+				exit(-1);
+			}
+		else if (arg == "--autotune")
+			m_autotune = true;
 		else if (arg == "--list-devices")
 			m_shouldListDevices = true;
 		else if (arg == "--export-dag" && argc > i + 1)
@@ -312,9 +329,9 @@ public:
 				exit(-1);
 			}
 		else if (arg == "-C" || arg == "--cpu")
-			m_minerType = MinerType::CPU;
+			m_minerType = (m_minerType == MinerType::CL || m_minerType == MinerType::Mixed) ? MinerType::Mixed : MinerType::CPU;
 		else if (arg == "-G" || arg == "--opencl")
-			m_minerType = MinerType::CL;
+			m_minerType = (m_minerType == MinerType::CPU || m_minerType == MinerType::Mixed) ? MinerType::Mixed : MinerType::CL;
 		else if (arg == "-P" || arg == "--opencl")
 			m_opMode = OperationMode::Pool;
 		else if (arg == "-S" || arg == "--opencl")
@@ -325,7 +342,9 @@ public:
 		}
 		else if (arg == "-X" || arg == "--cuda-opencl")
 		{
-			m_minerType = MinerType::Mixed;
+			// Mixed is CPU + OpenCL now, not CUDA + OpenCL.  there is no CUDA miner, so this
+			// just means OpenCL.
+			m_minerType = MinerType::CL;
 		}
 		else if (arg == "-M" || arg == "--benchmark")
 		{
@@ -395,7 +414,7 @@ public:
 			if (m_minerType == MinerType::CL || m_minerType == MinerType::Mixed)
 				EthashGPUMiner::listDevices();
 #if ETH_ETHASHCUDA
-			if (m_minerType == MinerType::CUDA || m_minerType == MinerType::Mixed)
+			if (m_minerType == MinerType::CUDA)
 				EthashCUDAMiner::listDevices();
 #endif
 			if (m_minerType == MinerType::CPU)
@@ -459,19 +478,22 @@ public:
 		}
 
 
-		// configure GPU
-		if (m_minerType == MinerType::CPU)
-		{
-			EthashCPUMiner::setNumInstances(m_miningThreads);
-		}
-		else if (m_minerType == MinerType::CL || m_minerType == MinerType::Mixed)
+		// configure GPU.  Mixed is OpenCL and CPU miners in the same farm.
+		if (m_minerType == MinerType::CL || m_minerType == MinerType::Mixed)
 		{
+			// with Mixed, -t is the number of CPU threads.
+			unsigned gpuInstances = m_minerType == MinerType::Mixed ? UINT_MAX : m_miningThreads;
 			if (m_openclDeviceCount > 0)
 			{
 				EthashGPUMiner::setDevices(m_openclDevices, m_openclDeviceCount);
-				m_miningThreads = m_openclDeviceCount;
+				gpuInstances = m_openclDeviceCount;
 			}
 			
+			if (m_hashesPerItem == 0)
+				m_hashesPerItem = atoi(ProgOpt::Get("Kernel", "HashesPerItem", "1").c_str());
+			EthashGPUMiner::setHashesPerItem(m_hashesPerItem);
+			EthashGPUMiner::setTuning(m_autotune, !m_workSizeGiven);
+
 			if (!EthashGPUMiner::configureGPU(
 					m_localWorkSize,
 					m_workSizeMultiplier,
@@ -484,9 +506,9 @@ public:
 					m_dagCreateDevice
 				))
 				exit(1);
-			EthashGPUMiner::setNumInstances(m_miningThreads);
+			EthashGPUMiner::setNumInstances(gpuInstances);
 		}
-		else if (m_minerType == MinerType::CUDA || m_minerType == MinerType::Mixed)
+		else if (m_minerType == MinerType::CUDA)
 		{
 #if ETH_ETHASHCUDA
 			if (m_cudaDeviceCount > 0)
@@ -513,6 +535,16 @@ public:
 #endif
 		}
 
+		// configure CPU
+		if (m_minerType == MinerType::CPU || m_minerType == MinerType::Mixed)
+		{
+			unsigned cpuInstances = m_miningThreads;
+			if (m_minerType == MinerType::Mixed && cpuInstances == UINT_MAX)
+				// leave a core to feed each GPU.
+				cpuInstances = std::max(1, int(std::thread::hardware_concurrency()) - int(EthashGPUMiner::instances()));
+			EthashCPUMiner::setNumInstances(cpuInstances);
+		}
+
 		if (m_doBenchmark)
 			doBenchmark(m_minerType, m_benchmarkWarmup, m_benchmarkTrial, m_benchmarkTrials);
 		else
@@ -561,15 +593,20 @@ public:
 			<< " Mining configuration:" << endl
 			<< "    -P  Pool mining" << endl
 			<< "    -S  Solo mining" << endl
-			<< "    -C,--cpu  CPU mining" << endl
+			<< "    -C,--cpu  CPU mining.  Combine with -G to mine on the CPU and the OpenCL devices together." << endl
 			<< "    -G,--opencl  When mining use the GPU via OpenCL." << endl
 			<< "    --cl-local-work <n> Set the OpenCL local work size. Default is " << toString(ethash_cl_miner::c_defaultLocalWorkSize) << endl
 			<< "    --cl-work-multiplier <n> This value multiplied by the cl-local-work value equals the number of hashes computed per kernel " << endl
 			<< "       run (ie. global work size). (Default: " << toString(ethash_cl_miner::c_defaultWorkSizeMultiplier) << ")" << endl
+			<< "    --cl-hashes-per-item <n> Number of hashes each work item computes per kernel run.  Higher values mean fewer, longer" << endl
+			<< "       kernel runs. Overrides the HashesPerItem setting in the ini file. (Default: 1)" << endl
+			<< "    --autotune  Find the best cl-local-work and cl-work-multiplier values for each OpenCL device when it starts," << endl
+			<< "       and save them.  Later runs use the saved values unless --cl-local-work or --cl-work-multiplier is given." << endl
 			<< "    --opencl-platform <n>  When mining using -G/--opencl use OpenCL platform n (default: 0)." << endl
 			<< "    --opencl-device <n>  When mining using -G/--opencl use OpenCL device n (default: 0)." << endl
 			<< "    --opencl-devices <0 1 ..n> Select which OpenCL devices to mine on. Default is to use all" << endl
 			<< "    -t, --mining-threads <n> Limit number of CPU miners to n (default: use everything available on selected platform)" << endl
+			<< "       With -C and -G together, the number of CPU threads (default: one per core, less one per GPU)." << endl
 			<< "    --allow-opencl-cpu  Allows CPU to be considered as an OpenCL device if the OpenCL platform supports it." << endl
 			<< "    --list-devices List the detected OpenCL/CUDA devices and exit. Should be combined with -G or -U flag" << endl
 			<< "    --cl-extragpu-mem <n> Set the memory (in MB) you believe your GPU requires for stuff other than mining. default: 0" << endl
@@ -589,30 +626,29 @@ public:
 	*----------------------------------------------------------------------------------*/
 	GenericFarm<EthashProofOfWork>::miners_t createMiners(MinerType _minerType, GenericFarm<EthashProofOfWork>* _f)
 	{
-		unsigned instances;
-		GenericFarm<EthashProofOfWork>::CreateInstanceFn create;
-		GenericFarm<EthashProofOfWork>::miners_t miners;
-
-		if (_minerType == MinerType::CPU)
-		{
-			instances = EthashCPUMiner::instances();
-			create = [] (GenericFarm<EthashProofOfWork>* _farm, unsigned _index) { return new EthashCPUMiner(_farm, _index); };
-		}
-		else if (_minerType == MinerType::CL)
-		{
-			instances = EthashGPUMiner::instances();
-			create = [] (GenericFarm<EthashProofOfWork>* _farm, unsigned _index) { return new EthashGPUMiner(_farm, _index); };
-		}
-		else if (_minerType == MinerType::CUDA)
+		typedef GenericFarm<EthashProofOfWork> Farm;
+		// each kind of miner in the farm, with how many of it.  in a Mixed farm the GPUs come first,
+		// then the CPU threads.  every miner gets its farm index and its index among its own kind.
+		std::vector<std::pair<unsigned, Farm::CreateInstanceFn>> kinds;
+
+		if (_minerType == MinerType::CL || _minerType == MinerType::Mixed)
+			kinds.push_back({EthashGPUMiner::instances(),
+				[] (Farm* _farm, unsigned _index, unsigned _instance) { return new EthashGPUMiner(_farm, _index, _instance); }});
+		if (_minerType == MinerType::CUDA)
 		{
 #if ETH_ETHASHCUDA
-			instances = EthashCUDAMiner::instances();
-			create = [] (GenericFarm* _farm, unsigned _index) { return new EthashCUDAMiner(_farm, _index); };
+			kinds.push_back({EthashCUDAMiner::instances(),
+				[] (Farm* _farm, unsigned _index, unsigned _instance) { return new EthashCUDAMiner(_farm, _index, _instance); }});
 #endif
 		}
+		if (_minerType == MinerType::CPU || _minerType == MinerType::Mixed)
+			kinds.push_back({EthashCPUMiner::instances(),
+				[] (Farm* _farm, unsigned _index, unsigned _instance) { return new EthashCPUMiner(_farm, _index, _instance); }});
 
-		for (unsigned i = 0; i < instances; ++i)
-			miners.push_back(create(_f, i));
+		Farm::miners_t miners;
+		for (auto const& kind : kinds)
+			for (unsigned i = 0; i < kind.first; ++i)
+				miners.push_back(kind.second(_f, miners.size(), i));
 
 		return miners;
 	}
@@ -636,7 +672,7 @@ private:
 
 		GenericFarm<EthashProofOfWork> f(m_opMode);
 
-		string platformInfo = _m == MinerType::CPU ? "CPU" : (_m == MinerType::CL ? "CL" : "CUDA");
+		string platformInfo = _m == MinerType::CPU ? "CPU" : (_m == MinerType::CL ? "CL" : (_m == MinerType::Mixed ? "CPU + CL" : "CUDA"));
 		LogS << "Benchmarking on platform: " << platformInfo;
 
 		h256 target = h256(1);	
@@ -652,21 +688,15 @@ private:
 			this_thread::sleep_for(chrono::milliseconds(1000));
 
 		LogS << "Warming up...";
-		for (unsigned i = 0; i <= _warmupDuration; i++)
-		{
-			f.hashRates().update();
-			this_thread::sleep_for(chrono::seconds(1));
-		}
+		this_thread::sleep_for(chrono::seconds(_warmupDuration + 1));
 		for (unsigned i = 0; i < _trials; ++i)
 		{
 			cout << "Trial " << i+1 << "... ";
-			for (unsigned s = 0; s < _trialDuration; s++)
-			{
-				this_thread::sleep_for(chrono::milliseconds(1000));
-				f.hashRates().update();
-			}
-			cout << f.hashRates().farmRate() << endl;
-			results.push_back(f.hashRates().farmRate());
+			this_thread::sleep_for(chrono::seconds(_trialDuration));
+			// the whole trial, from the hash rate sampler's 1 second history
+			float rate = f.hashRates().averageRate(_trialDuration);
+			cout << rate << endl;
+			results.push_back(rate);
 			mean += results.back();
 		}
 		f.stop();
@@ -692,7 +722,27 @@ private:
 		std::string s = "0" + std::to_string(seconds % 60);
 		return std::to_string(seconds / 60) + ":" + s.substr(s.length() - 2);
 	}	// elapsedSeconds
-	
+
+	// how busy the GPUs kept, when they can measure it.
+	std::string deviceBusy(GenericFarm<EthashProofOfWork> &f)
+	{
+		std::string busy = f.getDeviceStats();
+		return busy.empty() ? "" : " | Busy: " + busy;
+	}
+
+	// solutions the GPUs had to drop, or that went stale before they could be sent, only 
+	// shown once there are some.
+	std::string lostSolutions(GenericFarm<EthashProofOfWork> &f)
+	{
+		SolutionStats stats = f.getSolutionStats();
+		std::string s;
+		if (stats.getLost())
+			s = std::to_string(stats.getLost()) + " lost";
+		if (stats.getDropped())
+			s += (s.empty() ? "" : ", ") + std::to_string(stats.getDropped()) + " stale";
+		return s.empty() ? "" : " (" + s + ")";
+	}
+
 	/*-----------------------------------------------------------------------------------
 	* positionedOutput
 	*----------------------------------------------------------------------------------*/
@@ -700,25 +750,24 @@ private:
 						  uint64_t _difficulty, h256 _target)
 	{
 		int y = 2;
-		f.hashRates().update();
 		if (f.minerCount() <= 4)
 		{
-			LogXY(1, 1) << "Rates:" << f.hashRates() << " | Temp: " << f.getMinerTemps() << " | Fan: " << f.getFanSpeeds() << "         ";
+			LogXY(1, 1) << "Rates:" << f.hashRates() << " | Temp: " << f.getMinerTemps() << " | Fan: " << f.getFanSpeeds() << deviceBusy(f) << "         ";
 		} 
 		else
 		{
 			LogXY(1, 1) << "Rates:" << f.hashRates()  << "         ";
-			LogXY(1, 2) << "Temp: " << f.getMinerTemps() << " | Fan: " << f.getFanSpeeds() << "         ";
+			LogXY(1, 2) << "Temp: " << f.getMinerTemps() << " | Fan: " << f.getFanSpeeds() << deviceBusy(f) << "         ";
 			y = 3;
 		}
 		if (_opMode == OperationMode::Solo)
 		{
 			LogXY(1, y) << "Block #: " << f.currentBlock << " | Block time: " << elapsedSeconds(lastBlockTime) << " | Difficulty: " << _difficulty 
-						<< " | Solutions: " << f.getSolutionStats().getAccepts() << " | Tokens: " << tokenBalance << "      ";
+						<< " | Solutions: " << f.getSolutionStats().getAccepts() << lostSolutions(f) << " | Tokens: " << tokenBalance << "      ";
 		} 
 		else
 		{
-			LogXY(1, y) << "Difficulty: " << _difficulty << " | Shares: " << f.getSolutionStats().getAccepts() << " | Tokens: " << tokenBalance << "      ";
+			LogXY(1, y) << "Difficulty: " << _difficulty << " | Shares: " << f.getSolutionStats().getAccepts() << lostSolutions(f) << " | Tokens: " << tokenBalance << "      ";
 		}
 	}
 
@@ -815,12 +864,7 @@ private:
 	*----------------------------------------------------------------------------------*/
 	void doGetWork(GenericFarm<EthashProofOfWork>& f, string _nodeURL)
 	{
-		Timer lastHashRateDisplay;
 		Timer lastBlockTime;
-		Timer lastBalanceCheck;
-		Timer lastGetWork;
-		Timer lastCheckTx;
-		Timer devFeeSwitch;
 
 		// the absolute value of nextDevFeeSwitch is the time until the next switch.
 		// if the value is >= 0, that means we are currently mining to the user's account,
@@ -863,163 +907,163 @@ private:
 		uint64_t difficulty = 4;
 
 		int tokenBalance = nodeRPC->tokenBalance();
-
-		while (!m_shutdown)
+		// solutions collected from the farm, submitted oldest first
+		vector<SolutionRecord> solutions;
+
+		// everything below runs on this thread, from the events loop.  the timers do the
+		// periodic jobs, and the farm posts an event as soon as a solution is queued.
+		boost::asio::io_service events;
+		boost::asio::deadline_timer displayTimer(events), balanceTimer(events), workTimer(events),
+			txTimer(events), devFeeTimer(events), watchTimer(events);
+		std::function<void()> pollWork;
+
+		// runs _fn with the error handling for talking to the node / pool, and returns false if
+		// it couldn't be reached.  after that, only the work poll talks to it again, once every
+		// c_retrySeconds, until it answers (see pollWork).  solutions wait until then.
+		auto guarded = [&](std::function<void()> _fn) -> bool
 		{
 			try
 			{
-				h256 solution;
-				int solutionMiner;
-
-				while (!f.solutionFound(solution, solutionMiner) && !f.shutDown)
-				{
-					if (!challenge.empty())
-					{
-						// update the display
-						if (lastHashRateDisplay.elapsedSeconds() >= 2.0 && f.isMining())
-						{
-							int blkNum = 0;
-							try
-							{
-								if (m_opMode == OperationMode::Solo)
-									blkNum = nodeRPC->getBlockNumber() + 1;
-							}
-							catch (...) {}
-							if (blkNum != 0 && blkNum != f.currentBlock)
-							{
-								f.currentBlock = blkNum;
-								lastBlockTime.restart();
-							}
-							positionedOutput(m_opMode, f, lastBlockTime, tokenBalance, difficulty, target);
-							lastHashRateDisplay.restart();
-						}
-					}
-
-					// check token balance
-					if (lastBalanceCheck.elapsedSeconds() >= 60)
-					{
-						tokenBalance = nodeRPC->tokenBalance();
-						lastBalanceCheck.restart();
-					}
-
-					// check for new work
-					h256 _target;
-					bytes _challenge;
-					if (lastGetWork.elapsedMilliseconds() > m_pollingInterval || !connectedToNode)
-					{
-						if (m_opMode == OperationMode::Pool)
-						{
-							workRPC.getWorkPool(_challenge, _target, difficulty, f.hashingAcct);
-							// if we're choosing our own difficulty instead of using the pools, calcFinalTarget will make the adjustment
-							calcFinalTarget(f, _target, difficulty);
-						}
-						else
-						{
-							workRPC.getWorkSolo(_challenge, _target);
-							if (_challenge.size() != 32)
-							{
-								LogD << "Invalid challenge received from node: " + toHex(_challenge);
-								_challenge = challenge;
-							}
-							if (u256(_target) == 0)
-							{
-								LogD << "Invalid target received from node: 0";
-								_target = target;
-							}
-							difficulty = diffFromTarget(_target);
-						}
+				_fn();
+			}
+			catch (jsonrpc::JsonRpcException& e)
+			{
+				connectedToNode = false;
+				string msg = (m_opMode == OperationMode::Pool) ? "mining pool" : "node";
+				LogB << "An error occurred communicating with your " << msg << ". Please check your host/port settings.";
+				LogB << "Error text: " << e.what();
+				LogS << "Trying again in " << c_retrySeconds << " seconds ...";
+				return false;
+			}
+			catch (const std::exception& e)
+			{
+				LogB << "Exception: MinerAux::doGetWork - " << e.what();
+			}
+			return true;
+		};
 
-						lastGetWork.restart();
+		// check for new work
+		auto getWork = [&]()
+		{
+			if (!connectedToNode && farmRetries > 0)
+				LogS << "Connecting to " << _nodeURL << " ...";
 
-						if (!connectedToNode)
-						{
-							connectedToNode = true;
-							LogS << "Connection established.";
-						}
-						farmRetries = 0;
+			h256 _target;
+			bytes _challenge;
+			if (m_opMode == OperationMode::Pool)
+			{
+				workRPC.getWorkPool(_challenge, _target, difficulty, f.hashingAcct);
+				// if we're choosing our own difficulty instead of using the pools, calcFinalTarget will make the adjustment
+				calcFinalTarget(f, _target, difficulty);
+			}
+			else
+			{
+				workRPC.getWorkSolo(_challenge, _target);
+				if (_challenge.size() != 32)
+				{
+					LogD << "Invalid challenge received from node: " + toHex(_challenge);
+					_challenge = challenge;
+				}
+				if (u256(_target) == 0)
+				{
+					LogD << "Invalid target received from node: 0";
+					_target = target;
+				}
+				difficulty = diffFromTarget(_target);
+			}
 
-						if (_challenge != challenge)
-						{
-							// when queried for the most recent challenge, infura nodes will occasionally respond with the 
-							// previous one. this only applies to solo mining.  when pool mining, always use what the pool gives us.
-							bool seenBefore = false;
-							for (bytes c : recentChallenges)
-								seenBefore = (seenBefore || (c == _challenge));
-							if (!seenBefore || m_opMode == OperationMode::Pool)
-							{
-								recentChallenges.push_front(_challenge);
-								if (recentChallenges.size() > 5)
-									recentChallenges.pop_back();
-								challenge = _challenge;
-								target = _target;
-								LogB << "New challenge : " << toHex(_challenge).substr(0, 8);
-								f.setWork(challenge, target);
-							}
-						}
-						if (_target != target)
-						{
-							target = _target;
-							f.setWork(challenge, target);
-						}
-					}
+			if (!connectedToNode)
+			{
+				connectedToNode = true;
+				LogS << "Connection established.";
+			}
+			farmRetries = 0;
 
-					if (lastCheckTx.elapsedMilliseconds() > 1000 && m_opMode == OperationMode::Solo)
-					{
-						nodeRPC->checkPendingTransactions();
-						lastCheckTx.restart();
-					}
+			if (_challenge != challenge)
+			{
+				// when queried for the most recent challenge, infura nodes will occasionally respond with the 
+				// previous one. this only applies to solo mining.  when pool mining, always use what the pool gives us.
+				bool seenBefore = false;
+				for (bytes c : recentChallenges)
+					seenBefore = (seenBefore || (c == _challenge));
+				if (!seenBefore || m_opMode == OperationMode::Pool)
+				{
+					recentChallenges.push_front(_challenge);
+					if (recentChallenges.size() > 5)
+						recentChallenges.pop_back();
+					challenge = _challenge;
+					target = _target;
+					LogB << "New challenge : " << toHex(_challenge).substr(0, 8);
+					f.setWork(challenge, target);
+				}
+			}
+			if (_target != target)
+			{
+				target = _target;
+				f.setWork(challenge, target);
+			}
+		};
 
-					if (nextDevFeeSwitch != 0 && devFeeSwitch.elapsedSeconds() > abs(nextDevFeeSwitch))
-					{
-						if (nextDevFeeSwitch < 0)
-						{
-							LogB << "Switching to user mining.";
-							nextDevFeeSwitch = userFeeTime;
-							workRPC.devFeeMining = false;
-						} 
-						else
-						{
-							LogB << "Switching to dev fee mining.";
-							nextDevFeeSwitch = (-1) * devFeeTime;
-							workRPC.devFeeMining = true;
-						}
-						devFeeSwitch.restart();
-					}
+		auto submitSolutions = [&]()
+		{
+			f.solutionsFound(solutions);
+			if (!connectedToNode)
+				return;
+			while (!solutions.empty())
+			{
+				// taken off first, so a submission that throws isn't retried forever.
+				SolutionRecord solution = solutions.front();
+				solutions.erase(solutions.begin());
 
-					this_thread::sleep_for(chrono::milliseconds(200));
+				// found for a challenge we've since moved on from: not worth a round trip.
+				if (challenge.empty() || solution.epoch != f.challengeEpoch())
+				{
+					f.solutionStale(solution);
+					continue;
 				}
 
-				if (f.shutDown)
-					break;
-
 				bytes hash(32);
 				h160 sender(f.hashingAcct);
-				keccak256_0xBitcoin(challenge, sender, solution, hash);
+				keccak256_0xBitcoin(challenge, sender, solution.nonce, hash);
 				if (h256(hash) < target) {
-					if (m_opMode == OperationMode::Pool)
+					try
 					{
-						LogS << "Solution found; Submitting to pool" << ((nextDevFeeSwitch >= 0) ? "" : " on the dev account");
-						LogD << "Solution found: challenge = " << toHex(challenge).substr(0, 8) << ", nonce = " << solution.hex().substr(0, 8);
-						workRPC.submitWorkPool(solution, hash, challenge, difficulty);
+						if (m_opMode == OperationMode::Pool)
+						{
+							LogS << "Solution found; Submitting to pool" << ((nextDevFeeSwitch >= 0) ? "" : " on the dev account");
+							LogD << "Solution found: challenge = " << toHex(challenge).substr(0, 8) << ", nonce = " << solution.nonce.hex().substr(0, 8);
+							workRPC.submitWorkPool(solution.nonce, hash, challenge, difficulty);
+						}
+						else
+						{
+							LogB << "Solution found; Submitting to node";
+							workRPC.submitWorkSolo(solution.nonce, hash, challenge);
+						}
 					}
-					else
+					catch (...)
 					{
-						LogB << "Solution found; Submitting to node";
-						workRPC.submitWorkSolo(solution, hash, challenge);
+						// the rest wait in the queue, but this one is gone.
+						f.solutionsLost(1);
+						throw;
 					}
-					f.recordSolution(SolutionState::Accepted, false, solutionMiner);
+					f.recordSolution(SolutionState::Accepted, false, solution.miner);
+				} else if (h256(hash) < solution.target) {
+					// good for the target it was found under, but the target has since gone down.
+					f.solutionStale(solution);
 				} else {
-					LogB << "Solution found, but invalid.  Possibly stale.";
-					f.recordSolution(SolutionState::Accepted, true, solutionMiner);
+					LogB << "Solution found, but invalid.";
+					f.recordSolution(SolutionState::Failed, false, solution.miner);
 				}
 			}
-			catch (jsonrpc::JsonRpcException& e)
+		};
+
+		// the only place retries are counted, so they stay c_retrySeconds apart however many 
+		// other requests fail in between.
+		pollWork = [&]()
+		{
+			bool wasConnected = connectedToNode;
+			if (!guarded(getWork))
 			{
-				connectedToNode = false;
-				string msg = (m_opMode == OperationMode::Pool) ? "mining pool" : "node";
-				LogB << "An error occurred communicating with your " << msg << ". Please check your host/port settings.";
-				LogB << "Error text: " << e.what();
-				LogS << "Trying again in 5 seconds ...";
 				farmRetries++;
 				if (farmRetries == maxRetries)
 				{
@@ -1029,16 +1073,66 @@ private:
 					f.setWork(challenge, target);
 					LogS << "Mining paused ...";
 					if (failOverAvailable())
-						break;
+					{
+						events.stop();
+						return;
+					}
 				}
-				this_thread::sleep_for(chrono::seconds(5));
-				LogS << "Connecting to " << _nodeURL << " ...";
 			}
-			catch (const std::exception& e)
+			else if (connectedToNode && !wasConnected)
+				events.post([&]() { guarded(submitSolutions); });
+			after(workTimer, connectedToNode ? m_pollingInterval : c_retrySeconds * 1000, pollWork);
+		};
+
+		f.onSolutionQueued([&]() { events.post([&]() { guarded(submitSolutions); }); });
+
+		// update the display
+		every(displayTimer, 2000, [&]()
+		{
+			if (challenge.empty() || !f.isMining())
+				return;
+			int blkNum = 0;
+			try
 			{
-				LogB << "Exception: MinerAux::doGetWork - " << e.what();
+				if (m_opMode == OperationMode::Solo)
+					blkNum = nodeRPC->getBlockNumber() + 1;
 			}
-		}
+			catch (...) {}
+			if (blkNum != 0 && blkNum != f.currentBlock)
+			{
+				f.currentBlock = blkNum;
+				lastBlockTime.restart();
+			}
+			positionedOutput(m_opMode, f, lastBlockTime, tokenBalance, difficulty, target);
+		});
+
+		// check token balance
+		every(balanceTimer, 60 * 1000, [&]()
+		{
+			if (connectedToNode)
+				guarded([&]() { tokenBalance = nodeRPC->tokenBalance(); });
+		});
+
+		if (m_opMode == OperationMode::Solo)
+			every(txTimer, 1000, [&]()
+			{
+				if (connectedToNode)
+					guarded([&]() { nodeRPC->checkPendingTransactions(); });
+			});
+
+		scheduleDevFeeSwitch(devFeeTimer, nextDevFeeSwitch, userFeeTime, devFeeTime, [&](bool _devFee) { workRPC.devFeeMining = _devFee; });
+
+		// nothing tells us about these, so they're still checked for.
+		every(watchTimer, c_watchMs, [&]()
+		{
+			if (m_shutdown || f.shutDown)
+				events.stop();
+		});
+
+		pollWork();
+		events.run();
+
+		f.onSolutionQueued(nullptr);
 
 	}	// doGetWork
 
@@ -1049,17 +1143,14 @@ private:
 	void doStratum(GenericFarm<EthashProofOfWork>& f, string _nodeURL)
 	{
 
-		Timer lastHashRateDisplay;
 		Timer lastBlockTime;
-		Timer lastBalanceCheck;
-		Timer devFeeSwitch;
 
 		uint64_t difficulty = 0;
 		h256 target;
 		bytes challenge;
 
-		h256 solution;
-		int solutionMiner = -1;
+		// solutions collected from the farm, submitted oldest first
+		vector<SolutionRecord> solutions;
 
 		// the absolute value of nextDevFeeSwitch is the time until the next switch.
 		// if the value is >= 0, that means we are currently mining to the user's account,
@@ -1080,87 +1171,158 @@ private:
 
 		int tokenBalance = nodeRPC.tokenBalance();
 
-		while (client->isRunning())
+		// everything below runs on this thread, from the events loop.  the stratum client posts
+		// an event when the pool sends work, and the farm when a solution is queued.
+		boost::asio::io_service events;
+		boost::asio::deadline_timer displayTimer(events), balanceTimer(events), devFeeTimer(events), watchTimer(events);
+
+		auto checkWork = [&]()
 		{
+			h256 _target;
+			bytes _challenge;
+			client->getWork(_challenge, _target, difficulty, f.hashingAcct);
+			// if we're choosing our own difficulty instead of using the pools, calcFinalTarget will make the adjustment
+			calcFinalTarget(f, _target, difficulty);
 
-			while (!f.solutionFound(solution, solutionMiner) && !f.shutDown && client->isRunning())
+			if (_challenge != challenge)
 			{
-				if (lastHashRateDisplay.elapsedSeconds() >= 2.0 && client->isConnected() && f.isMining())
-				{
-					positionedOutput(OperationMode::Pool, f, lastBlockTime, tokenBalance, difficulty, target);
-					lastHashRateDisplay.restart();
-				}
-
-				h256 _target;
-				bytes _challenge;
-				client->getWork(_challenge, _target, difficulty, f.hashingAcct);
-				// if we're choosing our own difficulty instead of using the pools, calcFinalTarget will make the adjustment
-				calcFinalTarget(f, _target, difficulty);
-
-				if (_challenge != challenge)
-				{
-					challenge = _challenge;
-					target = _target;
-					LogB << "New challenge : " << toHex(_challenge).substr(0, 8);
-					f.setWork(challenge, target);
-				}
-				if (_target != target)
-				{
-					target = _target;
-					f.setWork(challenge, target);
-				}
-
-				if (lastBalanceCheck.elapsedSeconds() >= 60)
-				{
-					tokenBalance = nodeRPC.tokenBalance();
-					lastBalanceCheck.restart();
-				}
+				challenge = _challenge;
+				target = _target;
+				LogB << "New challenge : " << toHex(_challenge).substr(0, 8);
+				f.setWork(challenge, target);
+			}
+			if (_target != target)
+			{
+				target = _target;
+				f.setWork(challenge, target);
+			}
+		};
 
-				if (nextDevFeeSwitch != 0 && devFeeSwitch.elapsedSeconds() > abs(nextDevFeeSwitch))
+		auto submitSolutions = [&]()
+		{
+			if (!f.solutionsFound(solutions) || f.shutDown)
+				return;
+			for (auto& solution: solutions)
+			{
+				// found for a challenge we've since moved on from: not worth a round trip.
+				if (challenge.empty() || solution.epoch != f.challengeEpoch())
 				{
-					if (nextDevFeeSwitch < 0)
-					{
-						LogB << "Switching to user mining.";
-						nextDevFeeSwitch = userFeeTime;
-						client->switchAcct(m_userAcct);
-					} else
-					{
-						LogB << "Switching to dev fee mining.";
-						nextDevFeeSwitch = (-1) * devFeeTime;
-						client->switchAcct(DonationAddress);
-					}
-					devFeeSwitch.restart();
+					f.solutionStale(solution);
+					continue;
 				}
-				
-				this_thread::sleep_for(chrono::milliseconds(200));
-			}
 
-			if (f.shutDown)
-				break;
-
-			if (solutionMiner != -1)
-			{
 				bytes hash(32);
 				h160 sender(f.hashingAcct);
-				keccak256_0xBitcoin(challenge, sender, solution, hash);
+				keccak256_0xBitcoin(challenge, sender, solution.nonce, hash);
 				if (h256(hash) < target)
 				{
 					LogS << "Solution found; Submitting to pool";
-					LogD << "Solution found: challenge = " << toHex(challenge).substr(0, 8) << ", nonce = " << solution.hex().substr(0, 8);
-					client->submitWork(solution, hash, challenge, difficulty);
-					f.recordSolution(SolutionState::Accepted, false, solutionMiner);
+					LogD << "Solution found: challenge = " << toHex(challenge).substr(0, 8) << ", nonce = " << solution.nonce.hex().substr(0, 8);
+					client->submitWork(solution.nonce, hash, challenge, difficulty);
+					f.recordSolution(SolutionState::Accepted, false, solution.miner);
+				} else if (h256(hash) < solution.target)
+				{
+					// good for the target it was found under, but the target has since gone down.
+					f.solutionStale(solution);
 				} else
 				{
-					LogB << "Solution found, but invalid.  Possibly stale.";
-					f.recordSolution(SolutionState::Accepted, true, solutionMiner);
+					LogB << "Solution found, but invalid.";
+					f.recordSolution(SolutionState::Failed, false, solution.miner);
 				}
-				solutionMiner = -1;
 			}
+			solutions.clear();
+		};
 
-		}
+		client->onWork([&]() { events.post(checkWork); });
+		f.onSolutionQueued([&]() { events.post(submitSolutions); });
+
+		every(displayTimer, 2000, [&]()
+		{
+			if (client->isConnected() && f.isMining())
+				positionedOutput(OperationMode::Pool, f, lastBlockTime, tokenBalance, difficulty, target);
+			// the target can move with our own hash rate (see calcFinalTarget), not just with
+			// the pool's work.
+			checkWork();
+		});
+
+		every(balanceTimer, 60 * 1000, [&]() { tokenBalance = nodeRPC.tokenBalance(); });
+
+		scheduleDevFeeSwitch(devFeeTimer, nextDevFeeSwitch, userFeeTime, devFeeTime, [&](bool _devFee)
+		{
+			client->switchAcct(_devFee ? DonationAddress : m_userAcct);
+		});
+
+		// nothing tells us about these, so they're still checked for.
+		every(watchTimer, c_watchMs, [&]()
+		{
+			if (f.shutDown || !client->isRunning())
+				events.stop();
+		});
+
+		events.post(checkWork);
+		events.post(submitSolutions);
+		events.run();
+
+		client->onWork(nullptr);
+		f.onSolutionQueued(nullptr);
 
 	}	// doStratum
 
+	/*-----------------------------------------------------------------------------------
+	* after
+	*----------------------------------------------------------------------------------*/
+	void after(boost::asio::deadline_timer& _timer, unsigned _ms, std::function<void()> _fn)
+	{
+		// run _fn once, from the timer's io_service, in _ms milliseconds.  setting the timer 
+		// again before then cancels it.
+		_timer.expires_from_now(boost::posix_time::milliseconds(_ms));
+		_timer.async_wait([_fn](boost::system::error_code const& _ec)
+		{
+			if (!_ec)
+				_fn();
+		});
+	}
+
+	/*-----------------------------------------------------------------------------------
+	* every
+	*----------------------------------------------------------------------------------*/
+	void every(boost::asio::deadline_timer& _timer, unsigned _ms, std::function<void()> _fn)
+	{
+		// run _fn every _ms milliseconds, until the io_service stops.
+		after(_timer, _ms, [=, &_timer]()
+		{
+			_fn();
+			every(_timer, _ms, _fn);
+		});
+	}
+
+	/*-----------------------------------------------------------------------------------
+	* scheduleDevFeeSwitch
+	*----------------------------------------------------------------------------------*/
+	void scheduleDevFeeSwitch(boost::asio::deadline_timer& _timer, int& _nextDevFeeSwitch, int _userFeeTime, int _devFeeTime, 
+		std::function<void(bool)> _switch)
+	{
+		// see calcDevFeeTimes.  _switch(true) moves mining to the dev account, _switch(false) back.
+		if (_nextDevFeeSwitch == 0)
+			return;
+		after(_timer, abs(_nextDevFeeSwitch) * 1000, [=, &_timer, &_nextDevFeeSwitch]()
+		{
+			if (_nextDevFeeSwitch < 0)
+			{
+				LogB << "Switching to user mining.";
+				_nextDevFeeSwitch = _userFeeTime;
+				_switch(false);
+			} 
+			else
+			{
+				LogB << "Switching to dev fee mining.";
+				_nextDevFeeSwitch = (-1) * _devFeeTime;
+				_switch(true);
+			}
+			scheduleDevFeeSwitch(_timer, _nextDevFeeSwitch, _userFeeTime, _devFeeTime, _switch);
+		});
+	}
+
 
 private:
 
@@ -1183,6 +1345,7 @@ private:
 	unsigned m_workSizeMultiplier = ethash_cl_miner::c_defaultWorkSizeMultiplier;
 	unsigned m_localWorkSize = ethash_cl_miner::c_defaultLocalWorkSize;
 #endif
+	unsigned m_hashesPerItem = 0;		// 0 = take it from the ini file
 #endif
 #if ETH_ETHASHCUDA || !ETH_TRUE
 	unsigned m_workSizeMultiplier = ethash_cuda_miner::c_defaultGridSize;
@@ -1192,6 +1355,8 @@ private:
 	unsigned m_numStreams = ethash_cuda_miner::c_defaultNumStreams;
 	unsigned m_cudaSchedule = 4; // sync
 #endif
+	bool m_autotune = false;
+	bool m_workSizeGiven = false;		// --cl-local-work or --cl-work-multiplier on the command line
 	// default value was 350MB of GPU memory for other stuff (windows system rendering, e.t.c.)
 	unsigned m_extraGPUMemory = 0;// 350000000; don't assume miners run desktops...
 	unsigned m_dagLoadMode = 0; // parallel
@@ -28,6 +28,24 @@ using namespace dev;
 
 boost::random_device dev::s_fixedHashEngine;
 
+FastRandomEngine& FastRandomEngine::local()
+{
+	static thread_local FastRandomEngine s_engine;
+	return s_engine;
+}
+
+void FastRandomEngine::reseed()
+{
+	// draw a fresh 256-bit state from the OS every so often.  an all zero state would
+	// make xoshiro output zeros forever, so guard against it.
+	do
+	{
+		for (auto& i: m_s)
+			i = ((uint64_t) s_fixedHashEngine() << 32) | s_fixedHashEngine();
+	} while (!(m_s[0] | m_s[1] | m_s[2] | m_s[3]));
+	m_count = 1 << 20;
+}
+
 h128 dev::fromUUID(std::string const& _uuid)
 {
 	try
@@ -39,6 +39,42 @@ template <> struct StaticLog2<1> { enum { result = 0 }; };
 
 extern boost::random_device s_fixedHashEngine;
 
+/// Fast per-thread random number generator (xoshiro256**), seeded from s_fixedHashEngine and
+/// reseeded periodically.  Not suitable for secrets, use s_fixedHashEngine for those.
+class FastRandomEngine
+{
+public:
+	using result_type = uint64_t;
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return ~result_type(0); }
+
+	/// @returns the generator for the calling thread.
+	static FastRandomEngine& local();
+
+	result_type operator()()
+	{
+		if (m_count-- == 0)
+			reseed();
+		uint64_t result = rotl(m_s[1] * 5, 7) * 9;
+		uint64_t t = m_s[1] << 17;
+		m_s[2] ^= m_s[0];
+		m_s[3] ^= m_s[1];
+		m_s[1] ^= m_s[2];
+		m_s[0] ^= m_s[3];
+		m_s[2] ^= t;
+		m_s[3] = rotl(m_s[3], 45);
+		return result;
+	}
+
+private:
+	FastRandomEngine() { reseed(); }
+	void reseed();
+	static uint64_t rotl(uint64_t _x, int _k) { return (_x << _k) | (_x >> (64 - _k)); }
+
+	uint64_t m_s[4];
+	uint64_t m_count = 0;
+};
+
 /// Fixed-size raw-byte array container type, with an API optimised for storing hashes.
 /// Transparently converts to/from the corresponding arithmetic type; this will
 /// assume the data contained in the hash is big-endian.
@@ -210,8 +246,18 @@ public:
 			i = (uint8_t)boost::random::uniform_int_distribution<uint16_t>(0, 255)(_eng);
 	}
 
+	/// Populate with random data, 8 bytes per draw.
+	void randomize(FastRandomEngine& _eng)
+	{
+		for (unsigned i = 0; i < N; i += 8)
+		{
+			uint64_t r = _eng();
+			memcpy(m_data.data() + i, &r, std::min(8u, N - i));
+		}
+	}
+
 	/// @returns a random valued object.
-	static FixedHash random() { FixedHash ret; ret.randomize(s_fixedHashEngine); return ret; }
+	static FixedHash random() { FixedHash ret; ret.randomize(FastRandomEngine::local()); return ret; }
 
 	struct hash
 	{
@@ -32,6 +32,7 @@
 #include <assert.h>
 #include <queue>
 #include <vector>
+#include <map>
 #include <atomic>
 #include <sstream>
 #include <libethash/util.h>
@@ -43,6 +44,8 @@
 #include "ethminer/MultiLog.h"
 #include "ethminer/Misc.h"
 #include <libethash/sha3_cryptopp.h>
+#include <libdevcore/SHA3.h>
+#include <libethcore/KeccakMidstate.h>
 
 #define ETHASH_BYTES 32
 
@@ -75,17 +78,21 @@ using namespace dev;
 unsigned const ethash_cl_miner::c_defaultLocalWorkSize = 128;
 unsigned const ethash_cl_miner::c_defaultWorkSizeMultiplier = 196608;
 
-unsigned const c_nonceLinear = 1;
-unsigned const c_nonceRandom = 2;
-
-uint32_t const c_zero = 0;
 uint64_t const c_maxHash = ~uint64_t(0);
 
 // static initializers
 bool ethash_cl_miner::s_allowCPU = false;
+Mutex ethash_cl_miner::s_driverLock;
+std::condition_variable ethash_cl_miner::s_driverSignal;
+vector<ethash_cl_miner*> ethash_cl_miner::s_driven;
+bool ethash_cl_miner::s_driverStarted = false;
+bool ethash_cl_miner::s_driverChanged = false;
 unsigned ethash_cl_miner::s_extraRequiredGPUMem;
 unsigned ethash_cl_miner::s_workgroupSize = ethash_cl_miner::c_defaultLocalWorkSize;
 unsigned ethash_cl_miner::s_initialGlobalWorkSize = ethash_cl_miner::c_defaultWorkSizeMultiplier * ethash_cl_miner::c_defaultLocalWorkSize;
+unsigned ethash_cl_miner::s_hashesPerItem = 1;
+bool ethash_cl_miner::s_autotune = false;
+bool ethash_cl_miner::s_useSavedTuning = true;
 
 
 // TODO: If at any point we can use libdevcore in here then we should switch to using a LogChannel
@@ -121,14 +128,26 @@ ethash_cl_miner::search_hook::~search_hook() {}
 ethash_cl_miner::ethash_cl_miner(eth::EthashGPUMiner* _owner)
 	: m_openclOnePointOne(), m_owner(_owner)
 {
-	if (ProgOpt::Get("General", "NonceGeneration") == "Random")
-		m_nonceGeneration = c_nonceRandom;
-	else
-		m_nonceGeneration = c_nonceLinear;
 }
 
 ethash_cl_miner::~ethash_cl_miner()
 {
+	{
+		Guard l(x_builds);
+		m_buildExit = true;
+		m_buildSignal.notify_all();
+	}
+	if (m_builder.joinable())
+		m_builder.join();
+	// the map callbacks write into m_slots, and finish() doesn't wait for them.
+	try
+	{
+		discardPending();
+	}
+	catch (cl::Error const& err)
+	{
+		LogB << err.what() << "(" << err.err() << ")";
+	}
 	finish();
 }
 
@@ -321,58 +340,9 @@ void ethash_cl_miner::listDevices()
 
 void ethash_cl_miner::finish()
 {
-	for (int i = 0; i < c_bufferCount; i++)
-		if (m_queue[i]())
-			m_queue[i].finish();
-}
-
-uint64_t chi(uint64_t a, uint64_t b, uint64_t c)
-{
-	return a ^ ((~b) & c);
-}
-
-#define ROTL64(x, y) (((x) << (y)) ^ ((x) >> (64 - (y))))
-
-void keccak_precomp(uint64_t* mid, uint64_t* message)
-{
-	uint64_t C[4], D[5];
-	C[0] = message[0] ^ message[5] ^ message[10] ^ 0x100000000ull;
-	C[1] = message[1] ^ message[6] ^ 0x8000000000000000ull;
-	C[2] = message[2] ^ message[7];
-	C[3] = message[4] ^ message[9];
-
-	D[0] = ROTL64(C[1], 1) ^ C[3];
-	D[1] = ROTL64(C[2], 1) ^ C[0];
-	D[2] = ROTL64(message[3], 1) ^ C[1];
-	D[3] = ROTL64(C[3], 1) ^ C[2];
-	D[4] = ROTL64(C[0], 1) ^ message[3];
-
-	mid[0] = message[0] ^ D[0];
-	mid[1] = ROTL64(message[6] ^ D[1], 44);
-	mid[2] = ROTL64(D[2], 43);
-	mid[3] = ROTL64(D[3], 21);
-	mid[4] = ROTL64(D[4], 14);
-	mid[5] = ROTL64(message[3] ^ D[3], 28);
-	mid[6] = ROTL64(message[9] ^ D[4], 20);
-	mid[7] = ROTL64(message[10] ^ D[0] ^ 0x100000000ull, 3);
-	mid[8] = ROTL64(0x8000000000000000ull ^ D[1], 45);
-	mid[9] = ROTL64(D[2], 61);
-	mid[10] = ROTL64(message[1] ^ D[1], 1);
-	mid[11] = ROTL64(message[7] ^ D[2], 6);
-	mid[12] = ROTL64(D[3], 25);
-	mid[13] = ROTL64(D[4], 8);
-	mid[14] = ROTL64(D[0], 18);
-	mid[15] = ROTL64(message[4] ^ D[4], 27);
-	mid[16] = ROTL64(message[5] ^ D[0], 36);
-	mid[17] = ROTL64(D[1], 10);
-	mid[18] = ROTL64(D[2], 15);
-	mid[19] = ROTL64(D[3], 56);
-	mid[20] = ROTL64(message[2] ^ D[2], 62);
-	mid[21] = ROTL64(D[3], 55);
-	mid[22] = ROTL64(D[4], 39);
-	mid[23] = ROTL64(D[0], 41);
-	mid[24] = ROTL64(D[1], 2);
-
+	for (auto& slot: m_slots)
+		if (slot.queue())
+			slot.queue.finish();
 }
 
 void ethash_cl_miner::verifyHashes() {
@@ -401,16 +371,16 @@ void ethash_cl_miner::verifyHashes() {
 		memcpy(&message[52], nonce.data(), 32);
 
 		uint64_t precomp[25];
-		keccak_precomp(precomp, (uint64_t*) message);
-		m_queue[0].enqueueWriteBuffer(precompBuff, CL_TRUE, 0, 200, precomp);
+		eth::keccak_precomp(precomp, (uint64_t*) message);
+		m_slots[0].queue.enqueueWriteBuffer(precompBuff, CL_TRUE, 0, 200, precomp);
 
 		testKeccak.setArg(2, i);
 
-		m_queue[0].enqueueNDRangeKernel(testKeccak, cl::NullRange, i + 1, s_workgroupSize);
+		m_slots[0].queue.enqueueNDRangeKernel(testKeccak, cl::NullRange, i + 1, m_workgroupSize);
 
 		bytes kernelhash(8);
-		m_queue[0].enqueueReadBuffer(output, CL_TRUE, 0, 8, kernelhash.data());
-		m_queue[0].finish();
+		m_slots[0].queue.enqueueReadBuffer(output, CL_TRUE, 0, 8, kernelhash.data());
+		m_slots[0].queue.finish();
 
 		// now compute the hash on the CPU host and compare
 		bytes hash(32);
@@ -567,12 +537,13 @@ bool ethash_cl_miner::buildBinary(cl::Device& _device, std::string &_outfile)
 	}
 	binaries.push_back({p, len});
 	m_programBin = cl::Program(m_context, {_device}, binaries);
+	delete[] p;
 	bool built = false;
 	try
 	{
 		m_programBin.build({_device});
 		built = true;
-		m_searchKernel = cl::Kernel(m_programBin, "ethash_search");
+		createSearchKernel(m_programBin);
 	}
 	catch (cl::Error const& err)
 	{
@@ -587,20 +558,101 @@ bool ethash_cl_miner::buildBinary(cl::Device& _device, std::string &_outfile)
 }
 
 
-uint64_t ethash_cl_miner::nextNonceIndex(uint64_t &_nonceIndex, bool _overrideRandom) {
-	// even if we are using the linear method, we still need to generate a random nonce at the begining
-	// of each work package, which is what the override parameter is for.
-	if (m_nonceGeneration == c_nonceLinear && !_overrideRandom)
-		return _nonceIndex++;
-	else {
-		// look for a new random nonce index we (or any other miner) haven't checked yet.
-		do {
-			_nonceIndex = m_randDist(m_randGen);
-		} while (!m_owner->storeNonceIndex(_nonceIndex));
-		return _nonceIndex;
+/*-----------------------------------------------------------------------------------
+* saved results
+*----------------------------------------------------------------------------------*/
+// per device results are kept in text files in the app data folder, one device per line:
+// the values, then the key (<device name> / <driver version>).
+//		autotune.txt		<local work size> <work multiplier> <key>		(--autotune)
+//		kernelvariant.txt	<variant name> <key>							([Kernel] KernelVariant=auto)
+
+static Mutex x_saved;
+
+static bool parseSaved(string const& _line, unsigned _count, vector<string>& _values, string& _key)
+{
+	istringstream ss(_line);
+	_values.assign(_count, string());
+	for (auto& value: _values)
+		if (!(ss >> value))
+			return false;
+	return getline(ss >> ws, _key) && !_key.empty();
+}
+
+static bool loadSaved(string const& _file, string const& _key, unsigned _count, vector<string>& _values)
+{
+	Guard l(x_saved);
+	ifstream fs((getAppDataFolder() / _file).string());
+	string line, key;
+	while (getlineEx(fs, line))
+		if (parseSaved(line, _count, _values, key) && key == _key)
+			return true;
+	return false;
+}
+
+static void saveSaved(string const& _file, string const& _key, vector<string> const& _values)
+{
+	Guard l(x_saved);
+	boost::filesystem::path path = getAppDataFolder() / _file;
+	vector<string> lines;
+	{
+		ifstream fs(path.string());
+		string line, key;
+		vector<string> values;
+		while (getlineEx(fs, line))
+			if (parseSaved(line, _values.size(), values, key) && key != _key)
+				lines.push_back(line);
 	}
+	string line;
+	for (auto const& value: _values)
+		line += value + " ";
+	lines.push_back(line + _key);
+	ofstream fs(path.string(), ios::trunc);
+	for (auto const& line: lines)
+		fs << line << "\n";
+}
+
+static bool loadTuning(string const& _key, unsigned& _localWorkSize, unsigned& _workMultiplier)
+{
+	vector<string> values;
+	if (!loadSaved("autotune.txt", _key, 2, values))
+		return false;
+	_localWorkSize = strToInt(values[0], 0);
+	_workMultiplier = strToInt(values[1], 0);
+	return _localWorkSize && _workMultiplier;
+}
+
+static void saveTuning(string const& _key, unsigned _localWorkSize, unsigned _workMultiplier)
+{
+	saveSaved("autotune.txt", _key, {toString(_localWorkSize), toString(_workMultiplier)});
+}
+
+// average milliseconds per launch over _runs back to back launches, after one to warm up.
+static double timeKernel(cl::CommandQueue& _queue, cl::Kernel& _kernel, unsigned _global, unsigned _local, unsigned _runs)
+{
+	_queue.enqueueNDRangeKernel(_kernel, cl::NullRange, _global, _local);
+	_queue.finish();
+	auto start = chrono::steady_clock::now();
+	for (unsigned i = 0; i < _runs; i++)
+		_queue.enqueueNDRangeKernel(_kernel, cl::NullRange, _global, _local);
+	_queue.finish();
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / _runs;
 }
 
+/*-----------------------------------------------------------------------------------
+* pipelineDepth
+*----------------------------------------------------------------------------------*/
+// number of kernel launches kept in flight on this device.  [Kernel] PipelineDepth is either 
+// a single value, or a comma separated list in device order, where the last entry applies 
+// to any devices beyond the end of the list.
+static unsigned pipelineDepth(unsigned _deviceId)
+{
+	stringstream ss(ProgOpt::Get("Kernel", "PipelineDepth", toString((unsigned) ethash_cl_miner::c_defaultPipelineDepth)));
+	string item;
+	int depth = ethash_cl_miner::c_defaultPipelineDepth;
+	for (unsigned i = 0; getline(ss, item, ',') && i <= _deviceId; i++)
+		depth = strToInt(item, ethash_cl_miner::c_defaultPipelineDepth);
+	return max(1, min<int>(depth, ethash_cl_miner::c_maxPipelineDepth));
+}
 
 bool ethash_cl_miner::init(unsigned _platformId, unsigned _deviceId)
 {
@@ -672,60 +724,82 @@ bool ethash_cl_miner::init(unsigned _platformId, unsigned _deviceId)
 		else {
 			sprintf(options, "%s", "");
 		}
-		// create context
-		m_context = cl::Context(vector<cl::Device>(&cl_device, &cl_device + 1));
+		// create context.  with [Kernel] SingleThread all devices on the platform share one.
+		m_singleThread = ProgOpt::Get("Kernel", "SingleThread", "0") == "1";
+		if (m_singleThread)
+		{
+			static map<unsigned, cl::Context> s_contexts;
+			if (!s_contexts.count(_platformId))
+			{
+				LogB << "One host thread drives all OpenCL devices.";
+				s_contexts[_platformId] = cl::Context(devices);
+			}
+			m_context = s_contexts[_platformId];
+			m_drainLock = &s_driverLock;
+			m_drainSignal = &s_driverSignal;
+		}
+		else
+			m_context = cl::Context(vector<cl::Device>(&cl_device, &cl_device + 1));
 		LogF << "Trace: ethash_cl_miner::init-3a, device[" << _deviceId << "]";
-		for (int i = 0; i < c_bufferCount; i++)
-			m_queue[i] = cl::CommandQueue(m_context, cl_device);
+		m_slots.resize(pipelineDepth(_deviceId));
+		for (auto& slot: m_slots)
+			slot.queue = cl::CommandQueue(m_context, cl_device, CL_QUEUE_PROFILING_ENABLE);
 
 		l.unlock();
 
-		// make sure that global work size is evenly divisible by the local workgroup size
-		LogF << "Trace: ethash_cl_miner::init-4, device[" << _deviceId << "]";
-		m_globalWorkSize = s_initialGlobalWorkSize;
-		if (m_globalWorkSize % s_workgroupSize != 0)
-			m_globalWorkSize = ((m_globalWorkSize / s_workgroupSize) + 1) * s_workgroupSize;
-
-		// patch source code
-		// note: ETHASH_CL_MINER_KERNEL is simply ethash_cl_miner_kernel.cl compiled
-		// into a byte array by bin2h.cmake. There is no need to load the file by hand in runtime
-		string code(ETHASH_CL_MINER_KERNEL, ETHASH_CL_MINER_KERNEL + ETHASH_CL_MINER_KERNEL_SIZE);
-		addDefinition(code, "GROUP_SIZE", s_workgroupSize);
-		addDefinition(code, "ACCESSES", ETHASH_ACCESSES);
-		addDefinition(code, "MAX_OUTPUTS", c_maxSearchResults);
-		addDefinition(code, "PLATFORM", platformId);
-		addDefinition(code, "COMPUTE", computeCapability);
-
-		// create miner OpenCL program
-		cl::Program::Sources sources;
-		sources.push_back({code.c_str(), code.size()});
-		m_programCL = cl::Program(m_context, sources);
-		bool built = false;
-		try
+		// buffers
+		
+		for (auto& slot: m_slots)
 		{
-			m_programCL.build({cl_device}, options);
-			built = true;
-			m_searchKernel = cl::Kernel(m_programCL, "bitcoin0x_search");
+			slot.searchBuffer = cl::Buffer(m_context, CL_MEM_READ_WRITE, sizeof(search_results));
+			slot.miner = this;
+			slot.drained = true;
+			slot.precompBuffer = cl::Buffer(m_context, CL_MEM_READ_ONLY, 200);
 		}
-		catch (cl::Error const& err)
+
+		// work sizes: from the command line, or from a saved or fresh auto-tune for this device.
+		// the global work size has to be a multiple of the local work size, and the kernel
+		// reports solutions relative to the start of the launch in 32 bits.
+		LogF << "Trace: ethash_cl_miner::init-4, device[" << _deviceId << "]";
+		m_workgroupSize = s_workgroupSize;
+		m_globalWorkSize = s_initialGlobalWorkSize;
+		auto fitWorkSizes = [&]()
 		{
-			if (!built)
-				LogB << " Build error : " << err.err() << " \n" << m_programCL.getBuildInfo<CL_PROGRAM_BUILD_LOG>(cl_device) << "\n";
-			else
-				LogB << " Kernel error : " << err.err() << " Did you specify an existing kernel name? " << err.what() << "\n";
-			return false;
-		}
-		
-		// buffers
-		
-		for (unsigned i = 0; i != c_bufferCount; ++i)
+			if (m_globalWorkSize % m_workgroupSize != 0)
+				m_globalWorkSize = ((m_globalWorkSize / m_workgroupSize) + 1) * m_workgroupSize;
+			m_hashesPerItem = max<unsigned>(1, min<uint64_t>(s_hashesPerItem, (uint64_t(1) << 32) / m_globalWorkSize));
+		};
+		fitWorkSizes();
+
+		// the variant is picked first, so the work sizes are tuned for the kernel that runs.
+		string tuningKey = string(cl_device.getInfo<CL_DEVICE_NAME>().c_str()) + " / " + string(cl_device.getInfo<CL_DRIVER_VERSION>().c_str());
+		selectVariant(cl_device, tuningKey, options, platformId, computeCapability);
+
+		unsigned localWorkSize, workMultiplier;
+		if (s_autotune)
+			autotune(cl_device, tuningKey, options, platformId, computeCapability);
+		else if (s_useSavedTuning && loadTuning(tuningKey, localWorkSize, workMultiplier))
 		{
-			m_searchBuffer[i] = cl::Buffer(m_context, CL_MEM_READ_WRITE, sizeof(search_results));
-			// first element of solutions will store the number of hash solutions found
-			m_queue[0].enqueueWriteBuffer(m_searchBuffer[i], false, 0, 4, &c_zero);
-			m_precompBuffer[i] = cl::Buffer(m_context, CL_MEM_READ_ONLY, 200);
+			LogB << "Using saved tuning for device[" << _deviceId << "] : local work size = " << localWorkSize
+				<< ", work multiplier = " << workMultiplier;
+			m_workgroupSize = localWorkSize;
+			m_globalWorkSize = workMultiplier * localWorkSize;
 		}
 
+		fitWorkSizes();
+		if (m_hashesPerItem != s_hashesPerItem)
+			LogB << "Hashes per work item reduced to " << m_hashesPerItem << ", device[" << _deviceId << "]";
+
+		if (!buildSearchKernel(cl_device, m_workgroupSize, options, platformId, computeCapability))
+			return false;
+
+		// kept for building specialized kernels later on.
+		m_clDevice = cl_device;
+		m_buildOptions = options;
+		m_platformKind = platformId;
+		m_computeCapability = computeCapability;
+		m_specialize = ProgOpt::Get("Kernel", "SpecializeKernel", "0") == "1";
+
 	}
 	catch (cl::Error const& err)
 	{
@@ -737,164 +811,890 @@ bool ethash_cl_miner::init(unsigned _platformId, unsigned _deviceId)
 }
 
 
-void ethash_cl_miner::search(bytes _challenge, uint64_t _target, h160 _miningAccount, search_hook& _hook)
+/*-----------------------------------------------------------------------------------
+* kernel variants
+*----------------------------------------------------------------------------------*/
+// combinations of the KECCAK_* switches in the kernel.  [Kernel] KernelVariant picks one by
+// name, or with "auto" they are all benchmarked on each device and the fastest is kept.
+
+struct kernel_variant
+{
+	char const* name;
+	unsigned rotate;
+	unsigned finalRound;
+	unsigned unroll;
+	unsigned lanes;
+};
+
+static kernel_variant const c_kernelVariants[] = {
+	{"default",			0, 0, 0, 0},
+	{"final",			0, 1, 0, 0},
+	{"final-shift",		1, 1, 0, 0},
+	{"final-rotate",	2, 1, 0, 0},
+	{"final-unroll2",	0, 1, 2, 0},
+	{"final-unrolled",	0, 1, 23, 0},
+	{"ulong",			2, 1, 0, 1},
+	{"ulong-unrolled",	2, 1, 23, 1}
+};
+
+static unsigned const c_kernelVariantCount = sizeof(c_kernelVariants) / sizeof(c_kernelVariants[0]);
+
+string ethash_cl_miner::kernelSource(unsigned _workgroupSize, int _platformId, int _computeCapability, unsigned _variant)
+{
+	// patch source code
+	// note: ETHASH_CL_MINER_KERNEL is simply ethash_cl_miner_kernel.cl compiled
+	// into a byte array by bin2h.cmake. There is no need to load the file by hand in runtime
+	string code(ETHASH_CL_MINER_KERNEL, ETHASH_CL_MINER_KERNEL + ETHASH_CL_MINER_KERNEL_SIZE);
+	addDefinition(code, "GROUP_SIZE", _workgroupSize);
+	addDefinition(code, "ACCESSES", ETHASH_ACCESSES);
+	addDefinition(code, "MAX_OUTPUTS", c_maxSearchResults);
+	addDefinition(code, "MAX_CLOSE_HITS", c_maxCloseHits);
+	addDefinition(code, "PLATFORM", _platformId);
+	addDefinition(code, "COMPUTE", _computeCapability);
+	addDefinition(code, "KECCAK_ROTATE", c_kernelVariants[_variant].rotate);
+	addDefinition(code, "KECCAK_FINAL_ROUND", c_kernelVariants[_variant].finalRound);
+	addDefinition(code, "KECCAK_UNROLL", c_kernelVariants[_variant].unroll);
+	addDefinition(code, "KECCAK_LANES", c_kernelVariants[_variant].lanes);
+	return code;
+}
+
+/*-----------------------------------------------------------------------------------
+* ethash_cl_miner::buildSearchKernel
+*----------------------------------------------------------------------------------*/
+bool ethash_cl_miner::buildSearchKernel(cl::Device const& _device, unsigned _workgroupSize, string const& _options, int _platformId, int _computeCapability)
+{
+	string code = kernelSource(_workgroupSize, _platformId, _computeCapability, m_variant);
+
+	// compiling takes a while, so the program binary is cached in the app data folder, under
+	// a hash of everything that goes into it.
+	string cacheKey = string(_device.getInfo<CL_DEVICE_NAME>().c_str()) + "\n" + string(_device.getInfo<CL_DEVICE_VERSION>().c_str()) + "\n" 
+		+ string(_device.getInfo<CL_DRIVER_VERSION>().c_str()) + "\n" + _options + "\n" + code;
+	boost::filesystem::path cacheFile = getAppDataFolder() / "kernels" / (sha3(cacheKey).hex().substr(0, 32) + ".bin");
+	if (loadCachedProgram(_device, cacheFile))
+		return true;
+
+	// create miner OpenCL program
+	cl::Program::Sources sources;
+	sources.push_back({code.c_str(), code.size()});
+	m_programCL = cl::Program(m_context, sources);
+	bool built = false;
+	try
+	{
+		m_programCL.build({_device}, _options.c_str());
+		built = true;
+		createSearchKernel(m_programCL);
+	}
+	catch (cl::Error const& err)
+	{
+		if (!built)
+			LogB << " Build error : " << err.err() << " \n" << m_programCL.getBuildInfo<CL_PROGRAM_BUILD_LOG>(_device) << "\n";
+		else
+			LogB << " Kernel error : " << err.err() << " Did you specify an existing kernel name? " << err.what() << "\n";
+		return false;
+	}
+	saveCachedProgram(_device, cacheFile);
+	return true;
+}
+
+void ethash_cl_miner::createSearchKernel(cl::Program& _program)
+{
+	if (m_hashesPerItem > 1)
+	{
+		m_searchKernel = cl::Kernel(_program, "bitcoin0x_search_loop");
+		m_searchKernel.setArg(4, m_hashesPerItem);
+	}
+	else
+		m_searchKernel = cl::Kernel(_program, "bitcoin0x_search");
+}
+
+/*-----------------------------------------------------------------------------------
+* ethash_cl_miner::loadCachedProgram
+*----------------------------------------------------------------------------------*/
+bool ethash_cl_miner::loadCachedProgram(cl::Device const& _device, boost::filesystem::path const& _file)
+{
+	char* p;
+	int len;
+	if (!loadProgramBinary(_file.string().c_str(), p, len))
+		return false;
+	std::unique_ptr<char[]> binary(p);
+	try
+	{
+		cl::Program::Binaries binaries;
+		binaries.push_back({p, len});
+		m_programCL = cl::Program(m_context, {_device}, binaries);
+		m_programCL.build({_device});
+		createSearchKernel(m_programCL);
+	}
+	catch (cl::Error const& err)
+	{
+		// most likely written by a different driver build.  it gets replaced once we've compiled.
+		LogF << "Trace: ethash_cl_miner::loadCachedProgram, rejected " << _file.string() << " : " << err.what() << "(" << err.err() << ")";
+		return false;
+	}
+	LogF << "Trace: ethash_cl_miner::loadCachedProgram, loaded " << _file.string() << ", device[" << m_device << "]";
+	return true;
+}
+
+/*-----------------------------------------------------------------------------------
+* ethash_cl_miner::saveCachedProgram
+*----------------------------------------------------------------------------------*/
+void ethash_cl_miner::saveCachedProgram(cl::Device const& _device, boost::filesystem::path const& _file)
 {
 	try
 	{
-		LogF << "Trace: ethash_cl_miner::search-1, challenge = " << toHex(_challenge).substr(0, 8) << ", target = "
-			<< std::hex << std::setw(16) << std::setfill('0') << _target << ", miningAccount = " << _miningAccount.hex() 
-			<< ", device[" << m_device << "]";
+		// the program has a binary per device in the context.  that's only _device, unless the
+		// context is shared ([Kernel] SingleThread), in which case the other devices' are empty.
+		vector<cl::Device> devices = m_programCL.getInfo<CL_PROGRAM_DEVICES>();
+		vector<size_t> sizes = m_programCL.getInfo<CL_PROGRAM_BINARY_SIZES>();
+		unsigned i = 0;
+		while (i < devices.size() && devices[i]() != _device())
+			i++;
+		if (i == devices.size() || i >= sizes.size() || sizes[i] == 0)
+			return;
+		bytes binary(sizes[i]);
+		vector<unsigned char*> data(devices.size(), nullptr);
+		data[i] = binary.data();
+		if (clGetProgramInfo(m_programCL(), CL_PROGRAM_BINARIES, data.size() * sizeof(unsigned char*), data.data(), NULL) != CL_SUCCESS)
+			return;
+
+		// devices of the same model share a file, so write it under a temporary name first.
+		boost::filesystem::create_directories(_file.parent_path());
+		boost::filesystem::path temp = _file;
+		temp += "." + toString(m_device);
+		{
+			ofstream fs(temp.string(), ios::binary | ios::trunc);
+			fs.write((char const*) binary.data(), binary.size());
+			if (!fs)
+				return;
+		}
+		boost::filesystem::rename(temp, _file);
+	}
+	catch (std::exception const& e)
+	{
+		LogF << "Trace: ethash_cl_miner::saveCachedProgram, " << e.what();
+	}
+}
 
-		int l_throttle = 0;		// percent throttling
-		int l_bufferCount;
-		// used for throttling calculations. does not include throttling delays.
-		Timer kernelTimer;
-		// put in a rough guess for now, in case we are throttling
-		int kernelTime = 100;
-		int batchCount = 0;
+/*-----------------------------------------------------------------------------------
+* ethash_cl_miner::autotune
+*----------------------------------------------------------------------------------*/
+// sweep local work sizes and work multipliers with the search kernel, and keep the fastest
+// combination.  GROUP_SIZE is compiled into the kernel, so every local work size needs its
+// own build.  a bigger launch has to be at least 2% faster to be picked, so that we don't
+// give up responsiveness to new work for nothing.
+void ethash_cl_miner::autotune(cl::Device const& _device, string const& _key, string const& _options, int _platformId, int _computeCapability)
+{
+	LogB << "Auto-tuning device[" << m_device << "] (" << _key << "), this can take a minute ...";
+
+	// nothing is below a target of 0, so the kernel never writes any output.  the header
+	// is cleared before every timing as well, so no launch is timed against a leftover
+	// close target.
+	pipeline_slot& slot = m_slots[0];
+	uint64_t precomp[25] = {0};
+	slot.queue.enqueueWriteBuffer(slot.precompBuffer, CL_TRUE, 0, sizeof(precomp), precomp);
+	search_header header;
+
+	unsigned maxLocal = min<unsigned>(c_maxTuneLocalWorkSize, _device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>());
+	double bestRate = 0, bestMs = 0;
+	unsigned bestLocal = 0, bestMultiplier = 0;
+	for (unsigned local = c_minTuneLocalWorkSize; local <= maxLocal; local *= 2)
+	{
+		if (!buildSearchKernel(_device, local, _options, _platformId, _computeCapability))
+			continue;
+		m_searchKernel.setArg(0, slot.precompBuffer);
+		m_searchKernel.setArg(1, slot.searchBuffer);
+		m_searchKernel.setArg(2, uint64_t(0));
+		m_searchKernel.setArg(3, uint64_t(0));
+
+		slot.queue.enqueueWriteBuffer(slot.searchBuffer, CL_TRUE, 0, sizeof(header), &header);
+		double latency = timeKernel(slot.queue, m_searchKernel, local, local, 3);
+		LogB << "  local work size " << local << " : launch latency " << std::fixed << std::setprecision(2) << latency << " ms";
+
+		double lastRate = 0;
+		for (unsigned multiplier = c_minTuneMultiplier; multiplier <= c_maxTuneMultiplier; multiplier *= 2)
+		{
+			uint64_t hashes = uint64_t(multiplier) * local * m_hashesPerItem;
+			if (hashes > (uint64_t(1) << 32))
+				break;
+			slot.queue.enqueueWriteBuffer(slot.searchBuffer, CL_TRUE, 0, sizeof(header), &header);
+			double ms = timeKernel(slot.queue, m_searchKernel, multiplier * local, local, 3);
+			double rate = hashes / ms * 1000;
+			LogF << "Autotune: device[" << m_device << "], local = " << local << ", multiplier = " << multiplier 
+				<< ", " << ms << " ms, " << rate / 1000000 << " MH/s";
+			if (ms > c_maxTuneBatchMs)
+				break;
+			if (rate > bestRate * 1.02)
+			{
+				bestRate = rate;
+				bestMs = ms;
+				bestLocal = local;
+				bestMultiplier = multiplier;
+			}
+			// stop once bigger launches no longer help.
+			if (rate < lastRate * 1.01)
+				break;
+			lastRate = rate;
+		}
+	}
+
+	if (!bestLocal)
+	{
+		LogB << "Auto-tuning device[" << m_device << "] failed, using default work sizes.";
+		return;
+	}
+	LogB << "Auto-tuned device[" << m_device << "] : local work size = " << bestLocal << ", work multiplier = " << bestMultiplier
+		<< ", " << std::fixed << std::setprecision(1) << bestRate / 1000000 << " MH/s, " << bestMs << " ms per kernel run";
+	m_workgroupSize = bestLocal;
+	m_globalWorkSize = bestMultiplier * bestLocal;
+	saveTuning(_key, bestLocal, bestMultiplier);
+}
 
+
+/*-----------------------------------------------------------------------------------
+* ethash_cl_miner::selectVariant
+*----------------------------------------------------------------------------------*/
+// pick the kernel variant for this device.  when benchmarking, every variant first has to
+// get a known search right, so a variant the compiler gets wrong can't be picked for being fast.
+// the benchmark's pick is saved, and only run again for a new device or driver.
+void ethash_cl_miner::selectVariant(cl::Device const& _device, string const& _key, string const& _options, int _platformId, int _computeCapability)
+{
+	auto findVariant = [&](string const& _name)
+	{
+		for (m_variant = 0; m_variant < c_kernelVariantCount; m_variant++)
+			if (_name == c_kernelVariants[m_variant].name)
+				return true;
+		m_variant = 0;
+		return false;
+	};
+
+	string wanted = ProgOpt::Get("Kernel", "KernelVariant", "auto");
+	if (wanted != "auto")
+	{
+		if (!findVariant(wanted))
+			LogB << "Unknown kernel variant \"" << wanted << "\", using the default.";
+		return;
+	}
+	vector<string> saved;
+	if (loadSaved("kernelvariant.txt", _key, 1, saved) && findVariant(saved[0]))
+	{
+		LogB << "Kernel variant for device[" << m_device << "] : " << c_kernelVariants[m_variant].name << " (saved)";
+		return;
+	}
+
+	// the known search: random work, and a target just above the lowest hash of one work 
+	// group's nonces, so exactly that nonce should be found.
+	uint8_t message[88] = {0};
+	h256 r = h256::random();
+	memcpy(&message[0], r.data(), 32);
+	r = h256::random();
+	memcpy(&message[32], r.data(), 32);
+	memset(&message[64], 0, 8);
+	uint64_t precomp[25];
+	eth::keccak_precomp(precomp, (uint64_t*) message);
+
+	unsigned checkCount = m_workgroupSize * m_hashesPerItem;
+	uint64_t lowest = c_maxHash;
+	uint32_t lowestIndex = 0;
+	for (unsigned i = 0; i < checkCount; i++)
+	{
+		((uint64_t*) message)[8] = i;
+		uint8_t hash[32];
+		SHA3_256((ethash_h256_t*) hash, message, 84);
+		uint64_t upper = 0;
+		for (unsigned b = 0; b < 8; b++)
+			upper = (upper << 8) | hash[b];
+		if (upper < lowest)
 		{
-			// if we're throttling we only use one buffer to keep things linear, so we can do a 
-			// pause inbetween each kernel run.
-			ReadGuard l(x_throttle);
-			l_bufferCount = (m_throttle == 0) ? c_bufferCount : 1;
+			lowest = upper;
+			lowestIndex = i;
 		}
+	}
 
-		h256 nonce;
-		uint8_t message[88] = {0};
-		memcpy(&message[0], _challenge.data(), 32);
-		memcpy(&message[32], _miningAccount.data(), 20);
+	pipeline_slot& slot = m_slots[0];
+	slot.queue.enqueueWriteBuffer(slot.precompBuffer, CL_TRUE, 0, sizeof(precomp), precomp);
+
+	double bestMs = 0;
+	unsigned best = 0;
+	for (unsigned v = 0; v < c_kernelVariantCount; v++)
+	{
+		m_variant = v;
+		if (!buildSearchKernel(_device, m_workgroupSize, _options, _platformId, _computeCapability))
+			continue;
+		m_searchKernel.setArg(0, slot.precompBuffer);
+		m_searchKernel.setArg(1, slot.searchBuffer);
+		m_searchKernel.setArg(2, lowest + 1);
+		m_searchKernel.setArg(3, uint64_t(0));
+
+		search_results results;
+		search_header header;
+		slot.queue.enqueueWriteBuffer(slot.searchBuffer, CL_TRUE, 0, sizeof(header), &header);
+		slot.queue.enqueueNDRangeKernel(m_searchKernel, cl::NullRange, m_workgroupSize, m_workgroupSize);
+		slot.queue.enqueueReadBuffer(slot.searchBuffer, CL_TRUE, 0, sizeof(results), &results);
+		if (results.header.count != 1 || results.solutions[0] != lowestIndex)
+		{
+			LogB << "Kernel variant " << c_kernelVariants[v].name << " gave wrong results on device[" << m_device << "], skipping it.";
+			continue;
+		}
+
+		m_searchKernel.setArg(2, uint64_t(0));
+		double ms = timeKernel(slot.queue, m_searchKernel, m_globalWorkSize, m_workgroupSize, 3);
+		LogF << "Trace: ethash_cl_miner::selectVariant, device[" << m_device << "], " << c_kernelVariants[v].name << " : " << ms << " ms";
+		if (bestMs == 0 || ms < bestMs)
+		{
+			bestMs = ms;
+			best = v;
+		}
+	}
+
+	m_variant = best;
+	LogB << "Kernel variant for device[" << m_device << "] : " << c_kernelVariants[best].name;
+	if (bestMs > 0)
+		saveSaved("kernelvariant.txt", _key, {c_kernelVariants[best].name});
+}
 
-		m_searchKernel.setArg(2, _target);
+/*-----------------------------------------------------------------------------------
+* ethash_cl_miner::specialize
+*----------------------------------------------------------------------------------*/
+// ask for a search kernel with this challenge's midstate compiled in.  it's built on the 
+// build thread, and launch() switches to it once it's ready.  a request that hasn't been 
+// started by the time the next one comes in is dropped.  these aren't cached, since the 
+// challenge won't come around again.
+void ethash_cl_miner::specialize(uint64_t const* _precomp)
+{
+	auto build = make_shared<specialized_kernel>();
+	ostringstream midstate;
+	midstate << std::hex;
+	for (unsigned i = 0; i < 25; i++)
+		midstate << (i ? ", " : "") << "(uint2)(0x" << uint32_t(_precomp[i]) << "u, 0x" << uint32_t(_precomp[i] >> 32) << "u)";
+	build->code = "#define MIDSTATE " + midstate.str() + "\n" + kernelSource(m_workgroupSize, m_platformKind, m_computeCapability, m_variant);
+	m_search.specialized = build;
+
+	Guard l(x_builds);
+	m_nextBuild = build;
+	if (!m_builder.joinable())
+		m_builder = thread([this]() { buildLoop(); });
+	m_buildSignal.notify_all();
+}
+
+/*-----------------------------------------------------------------------------------
+* ethash_cl_miner::buildLoop
+*----------------------------------------------------------------------------------*/
+void ethash_cl_miner::buildLoop()
+{
+	setThreadName("clbuild" + toString(m_device));
+	UniqueGuard l(x_builds);
+	while (true)
+	{
+		m_buildSignal.wait(l, [&]() { return m_nextBuild || m_buildExit; });
+		if (m_buildExit)
+			return;
+		shared_ptr<specialized_kernel> build = m_nextBuild;
+		m_nextBuild.reset();
+		l.unlock();
+		try
+		{
+			Timer timer;
+			cl::Program::Sources sources;
+			sources.push_back({build->code.c_str(), build->code.size()});
+			cl::Program program(m_context, sources);
+			program.build({m_clDevice}, m_buildOptions.c_str());
+			cl::Kernel kernel(program, m_hashesPerItem > 1 ? "bitcoin0x_search_loop" : "bitcoin0x_search");
+			if (m_hashesPerItem > 1)
+				kernel.setArg(4, m_hashesPerItem);
+
+			Guard g(build->x_ready);
+			build->program = program;
+			build->kernel = kernel;
+			build->ready = true;
+			LogF << "Trace: ethash_cl_miner::specialize, built in " << timer.elapsedMilliseconds() << " ms, device[" << m_device << "]";
+		}
+		catch (cl::Error const& err)
+		{
+			LogF << "Trace: ethash_cl_miner::specialize, build failed, device[" << m_device << "] : " << err.what() << "(" << err.err() << ")";
+		}
+		l.lock();
+	}
+}
 
-		LogF << "Trace: ethash_cl_miner::search-2, device[" << m_device << "]";
+/*-----------------------------------------------------------------------------------
+* ethash_cl_miner::drainResults
+*----------------------------------------------------------------------------------*/
+// map event callback.  it runs on the OpenCL runtime's thread as soon as a launch's results 
+// are readable, and copies them out so the buffer can be unmapped and reused right away.
+void CL_CALLBACK ethash_cl_miner::drainResults(cl_event _event, cl_int _status, void* _slot)
+{
+	(void) _event;
+	pipeline_slot& slot = *(pipeline_slot*) _slot;
+	search_header header;
+	if (_status == CL_COMPLETE)
+	{
+		header = slot.results->header;
+		header.count = min<unsigned>(header.count, c_maxSearchResults);
+		header.closeCount = min<unsigned>(header.closeCount, c_maxCloseHits);
+		memcpy(slot.hits, slot.results->solutions, header.count * sizeof(uint32_t));
+		for (unsigned i = 0; i < header.closeCount; i++)
+			slot.closeHits[i] = slot.results->closeHits[i][0];
+	}
+	ethash_cl_miner* miner = slot.miner;
+	Guard l(*miner->m_drainLock);
+	slot.found = header.count;
+	slot.overflow = header.overflow;
+	slot.best = header.best;
+	slot.closeFound = header.closeCount;
+	slot.drained = true;
+	miner->m_drainSignal->notify_all();
+}
+
+/*-----------------------------------------------------------------------------------
+* ethash_cl_miner::waitDrained
+*----------------------------------------------------------------------------------*/
+void ethash_cl_miner::waitDrained(pipeline_slot& _slot)
+{
+	UniqueGuard l(*m_drainLock);
+	m_drainSignal->wait(l, [&]() { return _slot.drained; });
+}
+
+/*-----------------------------------------------------------------------------------
+* ethash_cl_miner::discardPending
+*----------------------------------------------------------------------------------*/
+// drop the launches in flight without looking at their results.  their buffers are
+// still mapped, and their callbacks still to come, so they have to finish first.  all of
+// them are waited for before anything is unmapped, so an error unmapping one can't leave
+// a callback outstanding.
+void ethash_cl_miner::discardPending()
+{
+	for (auto const& batch: m_pending)
+		waitDrained(m_slots[batch.buf]);
+	deque<pending_batch> pending;
+	pending.swap(m_pending);
+	for (auto const& batch: pending)
+	{
+		pipeline_slot& slot = m_slots[batch.buf];
+		slot.queue.enqueueUnmapMemObject(slot.searchBuffer, slot.results);
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+* ethash_cl_miner::search
+*----------------------------------------------------------------------------------*/
+// runs until the hook says stop.  normally on the calling (miner) thread, sleeping until a
+// launch's results come in.  with [Kernel] SingleThread the driver thread does the work,
+// and the calling thread only waits for the search to end.
+void ethash_cl_miner::search(unsigned _epoch, unsigned _challengeEpoch, bytes _challenge, uint64_t _target, h160 _miningAccount, search_hook& _hook)
+{
+	LogF << "Trace: ethash_cl_miner::search-1, challenge = " << toHex(_challenge).substr(0, 8) << ", target = "
+		<< std::hex << std::setw(16) << std::setfill('0') << _target << ", miningAccount = " << _miningAccount.hex() 
+		<< ", device[" << m_device << "]";
+	try
+	{
+		beginSearch(_epoch, _challengeEpoch, _challenge, _target, _miningAccount, _hook);
+	}
+	catch (cl::Error const& err)
+	{
+		LogB << err.what() << "(" << err.err() << ")";
+		return;
+	}
 
+	LogF << "Trace: ethash_cl_miner::search-2, device[" << m_device << "]";
+	if (m_singleThread)
+		drive();
+	else
 		while (true)
 		{
-			// throttling: when we transition from not throttling to throttling, we skip the step
-			// of enqueueing a kernel run, on a one-time basis, and instead wait for the current
-			// kernel to finish. that way we can put a delay inbetween every kernel run.
-			// when we transition from throttling to not throttling, we skip the step of waiting
-			// for the kernel to finish and reading the results, and instead immediately queue up another kernel run.
-
-			checkThrottleChange(l_throttle, l_bufferCount);
-			if (l_throttle > 0)
-			{
-				int millisDelay;
-				if (l_throttle < 100)
-				{
-					millisDelay = int(l_throttle * kernelTime / (100.0 - l_throttle));
-					LogF << "Throttle: Sleeping for " << millisDelay << " ms, device[" << m_device << "]";
-				}
-				else
-				{
-					millisDelay = 100;
-					m_pending.clear();
-					LogF << "Throttle: Sleeping indefinitely : 100% throttle, device[" << m_device << "]";
-				}
+			chrono::steady_clock::time_point wake;
+			if (step(wake))
+				break;
+			UniqueGuard l(*m_drainLock);
+			m_drainSignal->wait_until(l, wake, [&]() { return drainedFront(); });
+		}
 
-				while (millisDelay > 0)
-				{
-					int thisDelay = min(100, millisDelay);
-					this_thread::sleep_for(chrono::milliseconds(thisDelay));
-					millisDelay = (l_throttle == 100) ? 100 : millisDelay - thisDelay;
-					checkThrottleChange(l_throttle, l_bufferCount);
-					if (l_throttle == 100) 
-						_hook.searched(0, 0, c_maxHash);	// keep the hash rates display up-to-date
-					// check for new work package
-					if (_hook.shouldStop())
-					{
-						LogF << "Throttle: Sleeping interrupted by new work package, device[" << m_device << "]";
-						// I'd use break but we're two levels deep.
-						goto out;
-					}
-				}
-			}
+	// however the search ended, nothing may be left in flight: the caller can delete us
+	// as soon as we return.
+	try
+	{
+		discardPending();
+	}
+	catch (cl::Error const& err)
+	{
+		LogB << err.what() << "(" << err.err() << ")";
+	}
+	LogF << "Trace: ethash_cl_miner::search-exit, device[" << m_device << "]";
+}
 
-			// queue up a kernel run. 
-			// old strategy : the idea is to always have one kernel running, and another queued up to run
-			// right after. that way we can process the results of the first kernel without holding up the next
-			// kernel.  the original ethminer program tried to do it with only one queue, two 'results' buffers and
-			// a blocking call to enqueueMapBuffer, which on paper seems like it would to the trick, but it wasn't.
-			// what would actually happen was that the enqueueMapBuffer call would block until BOTH kernels had finished.
-			// (You can use CodeXL to do a timeline trace to see for yourself).  What really needs to be done is
-			// have two command queues, two results buffers, and a non-blocking call to enqueueMapBuffer (with associated
-			// events to know when the data is available). this causes both kernels to run at the same time.  
-
-			kernelTimer.restart();
-			if (m_pending.size() < l_bufferCount)
-			{
-				nonce = h256::random();
-				memcpy(&message[52], nonce.data(), 32);
+/*-----------------------------------------------------------------------------------
+* ethash_cl_miner::beginSearch
+*----------------------------------------------------------------------------------*/
+void ethash_cl_miner::beginSearch(unsigned _epoch, unsigned _challengeEpoch, bytes const& _challenge, uint64_t _target, h160 _miningAccount, search_hook& _hook)
+{
+	search_state& s = m_search;
+	s.hook = &_hook;
+	s.epoch = _epoch;
+	s.challengeEpoch = _challengeEpoch;
+	s.challenge = _challenge;
+	s.target = _target;
+	s.throttle = 0;
+	// put in a rough guess for now, in case we are throttling
+	s.kernelTime = 100;
+	s.batchCount = 0;
+	s.batchSize = uint64_t(m_globalWorkSize) * m_hashesPerItem;
+	s.nextLaunch = chrono::steady_clock::now();
+	{
+		// if we're throttling we only use one buffer to keep things linear, so we can do a 
+		// pause inbetween each kernel run.
+		ReadGuard l(x_throttle);
+		s.bufferCount = (m_throttle == 0) ? m_slots.size() : 1;
+	}
 
-				uint64_t precomp[25];
-				keccak_precomp(precomp, (uint64_t*) message);
-				m_queue[m_buf].enqueueWriteBuffer(m_precompBuffer[m_buf], CL_TRUE, 0, 200, precomp);
+	// the kernel's nonce counter goes into bytes 12..19 of the nonce, and the start of each
+	// launch comes from the farm's nonce allocator, so the rest of the nonce is fixed.
+	s.nonce = m_owner->m_farm->nonceBase(m_owner->index());
+	memset(s.message, 0, sizeof(s.message));
+	memcpy(&s.message[32], _miningAccount.data(), 20);
+	memcpy(&s.message[52], s.nonce.data(), 32);
+	setSearchWork();
+}
 
-				m_searchKernel.setArg(0, m_precompBuffer[m_buf]);
-				m_searchKernel.setArg(1, m_searchBuffer[m_buf]);
+/*-----------------------------------------------------------------------------------
+* ethash_cl_miner::setSearchWork
+*----------------------------------------------------------------------------------*/
+// the midstate only changes with the challenge, so each buffer's copy is uploaded once 
+// per challenge, by the first launch that uses it after the change.  the generic kernel
+// runs until a specialized one for the current work is ready.  a new target on its own
+// only goes into the next launch's arguments.
+void ethash_cl_miner::setSearchWork()
+{
+	search_state& s = m_search;
+	memcpy(&s.message[0], s.challenge.data(), 32);
+	uint64_t precomp[25];
+	eth::keccak_precomp(precomp, (uint64_t*) s.message);
+	if (s.kernel() && memcmp(precomp, s.precomp, sizeof(precomp)) == 0)
+		return;
+	memcpy(s.precomp, precomp, sizeof(precomp));
+	s.kernel = m_searchKernel;
+	for (auto& slot: m_slots)
+		slot.uploaded = false;
+	s.specialized.reset();
+	if (m_specialize)
+		specialize(s.precomp);
+}
 
-				m_queue[m_buf].enqueueNDRangeKernel(m_searchKernel, cl::NullRange, m_globalWorkSize, s_workgroupSize);
-				m_pending.push_back({nonce, m_buf});
+/*-----------------------------------------------------------------------------------
+* ethash_cl_miner::drainedFront
+*----------------------------------------------------------------------------------*/
+// true if the oldest launch in flight can be read back.  call with *m_drainLock held.
+bool ethash_cl_miner::drainedFront() const
+{
+	return !m_pending.empty() && m_slots[m_pending.front().buf].drained;
+}
 
-				m_results[m_buf] = (search_results*) m_queue[m_buf].enqueueMapBuffer(m_searchBuffer[m_buf], CL_FALSE, CL_MAP_READ, 0, 
-																			   sizeof(search_results), 0, &m_mapEvents[m_buf]);
-				m_buf = (m_buf + 1) % l_bufferCount;
-			}
+/*-----------------------------------------------------------------------------------
+* ethash_cl_miner::launch
+*----------------------------------------------------------------------------------*/
+void ethash_cl_miner::launch()
+{
+	// queue up a kernel run. 
+	// old strategy : the idea is to always have one kernel running, and another queued up to run
+	// right after. that way we can process the results of the first kernel without holding up the next
+	// kernel.  the original ethminer program tried to do it with only one queue, two 'results' buffers and
+	// a blocking call to enqueueMapBuffer, which on paper seems like it would to the trick, but it wasn't.
+	// what would actually happen was that the enqueueMapBuffer call would block until BOTH kernels had finished.
+	// (You can use CodeXL to do a timeline trace to see for yourself).  What really needs to be done is
+	// have two command queues, two results buffers, and a non-blocking call to enqueueMapBuffer (with associated
+	// events to know when the data is available). this causes both kernels to run at the same time.  
+	// the same idea now runs over a ring of [Kernel] PipelineDepth slots, each with its own
+	// queue, buffers and map event, read back in the order they were launched.
+
+	// nothing here waits on the device.  the previous launch on this buffer has been read
+	// back, so its host copy of the midstate is free to be overwritten.
+	search_state& s = m_search;
+	pipeline_slot& slot = m_slots[m_buf];
+	uint64_t start = m_owner->m_farm->allocateNonces(m_owner->index(), s.batchSize);
+	if (!slot.uploaded)
+	{
+		memcpy(slot.precomp, s.precomp, sizeof(s.precomp));
+		slot.queue.enqueueWriteBuffer(slot.precompBuffer, CL_FALSE, 0, sizeof(slot.precomp), slot.precomp);
+		slot.uploaded = true;
+	}
 
-			if (m_pending.size() == l_bufferCount)
-			{
-				// read results
+	if (s.specialized)
+	{
+		Guard l(s.specialized->x_ready);
+		if (s.specialized->ready)
+		{
+			LogF << "Trace: ethash_cl_miner::search, switching to specialized kernel, device[" << m_device << "]";
+			s.kernel = s.specialized->kernel;
+			s.specialized.reset();
+		}
+	}
 
-				pending_batch batch = m_pending.front();
-				m_pending.pop_front();
+	s.kernel.setArg(0, slot.precompBuffer);
+	s.kernel.setArg(1, slot.searchBuffer);
+	s.kernel.setArg(2, s.target);
+	s.kernel.setArg(3, start);
 
-				// this blocks until the kernel finishes
-				m_mapEvents[batch.buf].wait();
+	// the hit counters are cleared ahead of every launch, so reading one launch's results
+	// never holds up the next.
+	slot.header = search_header();
+	slot.header.closeTarget = m_owner->closeHitThreshold();
+	slot.queue.enqueueWriteBuffer(slot.searchBuffer, CL_FALSE, 0, sizeof(slot.header), &slot.header);
+	slot.queue.enqueueNDRangeKernel(s.kernel, cl::NullRange, m_globalWorkSize, m_workgroupSize, nullptr, &slot.kernelEvent);
 
-				kernelTime = kernelTimer.elapsedMilliseconds();
+	{
+		Guard l(*m_drainLock);
+		slot.drained = false;
+	}
+	slot.results = (search_results*) slot.queue.enqueueMapBuffer(slot.searchBuffer, CL_FALSE, CL_MAP_READ, 0, 
+																   sizeof(search_results), 0, &slot.mapEvent);
+	slot.mapEvent.setCallback(CL_COMPLETE, drainResults, &slot);
+	// only once the callback is registered, since discardPending() waits for it.
+	m_pending.push_back({s.nonce, start, m_buf, s.challengeEpoch, s.target});
+	// launches are read back in order, so the slot after the latest one is the oldest.
+	m_buf = (m_buf + 1) % m_slots.size();
+}
 
-				unsigned num_found = min<unsigned>(m_results[batch.buf]->solutions[0], c_maxSearchResults);
-				h256 nonces[c_maxSearchResults];
-				for (unsigned i = 0; i != num_found; ++i) {
+/*-----------------------------------------------------------------------------------
+* ethash_cl_miner::readBack
+*----------------------------------------------------------------------------------*/
+// process the oldest launch, which has been drained.  returns true if the hook wants the 
+// search to stop.
+bool ethash_cl_miner::readBack()
+{
+	search_state& s = m_search;
+	pending_batch batch = m_pending.front();
+	m_pending.pop_front();
 
-					// in the kernel, the work item number is written into state[8], prior to doing the keccak hash, so we need 
-					// to do the same thing here so we can check the result.  that means writing the 
-					// solution starting at byte 12 of the nonce.
+	pipeline_slot& slot = m_slots[batch.buf];
+	s.kernelTime = int((slot.kernelEvent.getProfilingInfo<CL_PROFILING_COMMAND_END>()
+						- slot.kernelEvent.getProfilingInfo<CL_PROFILING_COMMAND_START>()) / 1000000);
+	profileLaunch(slot.kernelEvent, s.batchSize);
 
-					uint64_t soln = m_results[batch.buf]->solutions[i + 1];
-					nonces[i] = batch.nonce;
-					uint8_t* x = (uint8_t*) nonces[i].data();
-					*(uint64_t*) (&x[12]) = soln;
-				}
+	slot.queue.enqueueUnmapMemObject(slot.searchBuffer, slot.results);
 
-				m_queue[batch.buf].enqueueUnmapMemObject(m_searchBuffer[batch.buf], m_results[batch.buf]);
+	if (slot.overflow)
+	{
+		LogF << "Trace: ethash_cl_miner::search, " << slot.overflow << " solution(s) didn't fit in the results buffer, device[" << m_device << "]";
+		m_owner->m_farm->solutionsLost(slot.overflow);
+	}
 
-				if (num_found) {
-					m_queue[batch.buf].enqueueWriteBuffer(m_searchBuffer[batch.buf], false, 0, 4, &c_zero);
-					if (_hook.found(nonces, num_found))
-						break;
-				}
-				if (batch.buf == 0)
-					// hash rates come out smoother if we report regularly.
-					m_owner->accumulateHashes(m_globalWorkSize * l_bufferCount, batchCount++);
-				if (_hook.searched(0, 0, m_bestHash))
-					break;
-			}
+	unsigned num_found = slot.found;
+	h256 nonces[c_maxSearchResults];
+	for (unsigned i = 0; i != num_found; ++i) {
+
+		// in the kernel, the work item number is written into state[8], prior to doing the keccak hash, so we need 
+		// to do the same thing here so we can check the result.  that means writing the 
+		// solution starting at byte 12 of the nonce.  the kernel reports it relative to
+		// the start of the launch, so it fits in 32 bits.
+
+		uint64_t soln = batch.start + slot.hits[i];
+		nonces[i] = batch.nonce;
+		uint8_t* x = (uint8_t*) nonces[i].data();
+		*(uint64_t*) (&x[12]) = soln;
+	}
+
+	// only a new challenge makes a launch's results stale.  the hook checks solutions against
+	// the current challenge and target, and counts the stale ones.
+	uint64_t bestHash;
+	{
+		Guard l(x_bestHash);
+		if (batch.epoch == s.challengeEpoch)
+			m_bestHash = min(m_bestHash, slot.best);
+		bestHash = m_bestHash;
+	}
+	if (batch.epoch == s.challengeEpoch)
+		for (unsigned i = 0; i < slot.closeFound; i++)
+			s.hook->closeHit(slot.closeHits[i]);
+
+	if (num_found && s.hook->found(nonces, num_found, batch.epoch, batch.target))
+		return true;
+	m_owner->accumulateHashes(s.batchSize, s.batchCount++);
+	return s.hook->searched(0, 0, bestHash);
+}
+
+/*-----------------------------------------------------------------------------------
+* ethash_cl_miner::step
+*----------------------------------------------------------------------------------*/
+// one pass of the search, which never waits on the device: read back the launches that
+// have finished, and keep the pipeline full.  _wake is when step() wants to be called again
+// if no results come in before then.  returns true when the search is over.
+bool ethash_cl_miner::step(chrono::steady_clock::time_point& _wake)
+{
+	search_state& s = m_search;
+	search_hook& hook = *s.hook;
+	auto now = chrono::steady_clock::now();
+	_wake = now + chrono::milliseconds(c_pollMs);
+	try
+	{
+		// throttling: when we transition from not throttling to throttling, we stop launching until
+		// the launches in flight have been read back, and from then on keep a single one in flight,
+		// so we can put a delay inbetween every kernel run.
+		checkThrottleChange(s.throttle, s.bufferCount);
+		if (s.throttle == 100)
+		{
+			LogF << "Throttle: Sleeping indefinitely : 100% throttle, device[" << m_device << "]";
+			discardPending();
+			// keep the hash rates display up-to-date
+			return hook.searched(0, 0, c_maxHash);
 		}
 
-	out: ;
+		// new work goes into the next launch, while the ones already queued run to completion.
+		// their results are checked against the challenge epoch they were launched with.
+		unsigned epoch = s.epoch;
+		if (hook.newWork(s.epoch, s.challengeEpoch, s.challenge, s.target))
+			return true;
+		if (s.epoch != epoch)
+		{
+			LogF << "Trace: ethash_cl_miner::search, new work, challenge = " << toHex(s.challenge).substr(0, 8) 
+				<< ", device[" << m_device << "]";
+			setSearchWork();
+		}
 
+		// read back whatever has finished, oldest first.
+		while (true)
+		{
+			{
+				Guard l(*m_drainLock);
+				if (!drainedFront())
+					break;
+			}
+			if (readBack())
+				return true;
+			if (s.throttle > 0)
+			{
+				int millisDelay = int(s.throttle * s.kernelTime / (100.0 - s.throttle));
+				LogF << "Throttle: Sleeping for " << millisDelay << " ms, device[" << m_device << "]";
+				s.nextLaunch = chrono::steady_clock::now() + chrono::milliseconds(millisDelay);
+			}
+		}
 
+		while (m_pending.size() < s.bufferCount && chrono::steady_clock::now() >= s.nextLaunch)
+			launch();
+		if (m_pending.size() < s.bufferCount)
+			_wake = min(_wake, s.nextLaunch);
 	}
 	catch (cl::Error const& err)
 	{
 		LogB << err.what() << "(" << err.err() << ")";
+		return true;
 	}
-	LogF << "Trace: ethash_cl_miner::search-exit, device[" << m_device << "]";
+	return false;
+}
+
+/*-----------------------------------------------------------------------------------
+* ethash_cl_miner::drive
+*----------------------------------------------------------------------------------*/
+// [Kernel] SingleThread: hand the search to the driver thread, and wait for it to end.
+void ethash_cl_miner::drive()
+{
+	UniqueGuard l(s_driverLock);
+	if (!s_driverStarted)
+	{
+		s_driverStarted = true;
+		thread(driverLoop).detach();
+	}
+	m_search.done = false;
+	s_driven.push_back(this);
+	s_driverChanged = true;
+	s_driverSignal.notify_all();
+	s_driverSignal.wait(l, [&]() { return m_search.done; });
+}
+
+/*-----------------------------------------------------------------------------------
+* ethash_cl_miner::driverLoop
+*----------------------------------------------------------------------------------*/
+// steps every device with a search running, then sleeps until one of them has results (the
+// map callbacks share s_driverSignal), one of them asks to be woken, or a search is added.
+void ethash_cl_miner::driverLoop()
+{
+	setThreadName("cldriver");
+	UniqueGuard l(s_driverLock);
+	while (true)
+	{
+		s_driverChanged = false;
+		vector<ethash_cl_miner*> miners = s_driven;
+		l.unlock();
+
+		auto wake = chrono::steady_clock::now() + chrono::milliseconds(c_pollMs);
+		vector<ethash_cl_miner*> finished;
+		for (auto miner: miners)
+		{
+			chrono::steady_clock::time_point minerWake;
+			if (miner->step(minerWake))
+				finished.push_back(miner);
+			else
+				wake = min(wake, minerWake);
+		}
+
+		l.lock();
+		for (auto miner: finished)
+		{
+			s_driven.erase(find(s_driven.begin(), s_driven.end(), miner));
+			miner->m_search.done = true;
+		}
+		if (!finished.empty())
+			s_driverSignal.notify_all();
+		s_driverSignal.wait_until(l, wake, [&]()
+		{
+			return s_driverChanged || any_of(s_driven.begin(), s_driven.end(), [](ethash_cl_miner* m) { return m->drainedFront(); });
+		});
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+* ethash_cl_miner::profileLaunch
+*----------------------------------------------------------------------------------*/
+// add a finished launch's timestamps to the current window, and publish the window's
+// figures once it is c_profileWindowMs long.  launches are added in the order they were
+// made, so overlapping ones (from different pipeline queues) are only counted busy once.
+void ethash_cl_miner::profileLaunch(cl::Event const& _kernel, uint64_t _hashes)
+{
+	uint64_t queued = _kernel.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+	uint64_t start = _kernel.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+	uint64_t end = _kernel.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+	profile_window& w = m_profile;
+
+	if (w.launches == 0)
+	{
+		w.start = start;
+		w.lastEnd = start;
+	}
+	if (start > w.lastEnd)
+		w.gaps += start - w.lastEnd;
+	if (end > w.lastEnd)
+	{
+		w.busy += end - max(start, w.lastEnd);
+		w.lastEnd = end;
+	}
+	w.latency += start > queued ? start - queued : 0;
+	w.hashes += _hashes;
+	w.launches++;
+
+	uint64_t span = w.lastEnd - w.start;
+	if (span < uint64_t(c_profileWindowMs) * 1000000)
+		return;
+
+	eth::DeviceStats stats;
+	stats.busy = 100.0 * w.busy / span;
+	stats.gapMs = w.launches > 1 ? w.gaps / 1e6 / (w.launches - 1) : 0;
+	stats.latencyMs = w.latency / 1e6 / w.launches;
+	stats.hashRate = w.busy ? w.hashes * 1000.0 / w.busy : 0;
+	LogF << "Trace: ethash_cl_miner::profileLaunch, device[" << m_device << "] : busy = " << stats.busy << "%, gap = "
+		<< stats.gapMs << " ms, latency = " << stats.latencyMs << " ms, rate = " << stats.hashRate << " MH/s";
+	{
+		Guard l(x_deviceStats);
+		m_deviceStats = stats;
+		m_haveDeviceStats = true;
+	}
+	w = profile_window();
+}
+
+bool ethash_cl_miner::deviceStats(eth::DeviceStats& _stats)
+{
+	Guard l(x_deviceStats);
+	_stats = m_deviceStats;
+	return m_haveDeviceStats;
 }
 
-void ethash_cl_miner::checkThrottleChange(int& _localThrottle, int& _bufferCount)
+void ethash_cl_miner::checkThrottleChange(int& _localThrottle, unsigned& _bufferCount)
 {
 	ReadGuard l(x_throttle);
 	if (m_throttle > 0 && _localThrottle == 0)
@@ -904,7 +1704,7 @@ void ethash_cl_miner::checkThrottleChange(int& _localThrottle, int& _bufferCount
 	}
 	else if (_localThrottle > 0 && m_throttle == 0)
 	{
-		_bufferCount = c_bufferCount;
+		_bufferCount = m_slots.size();
 		LogF << "Throttle: Stop throttling, device[" << m_device << "]";
 	}
 	_localThrottle = m_throttle;
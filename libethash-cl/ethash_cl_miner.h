@@ -14,8 +14,12 @@
 
 #include <time.h>
 #include <functional>
+#include <memory>
 #include <random>
 #include <libethash/ethash.h>
+#include <condition_variable>
+#include <thread>
+#include <boost/filesystem.hpp>
 #include <libdevcore/Guards.h>
 #include "libethcore/EthashGPUMiner.h"
 
@@ -24,24 +28,40 @@ using namespace dev;
 class ethash_cl_miner
 {
 private:
-	enum { c_maxSearchResults = 63, c_bufferCount = 2, c_hashBatchSize = 1024 };
+	enum { c_maxSearchResults = 1023, c_maxCloseHits = 63, c_hashBatchSize = 1024 };
+	// --autotune search range
+	enum { c_minTuneLocalWorkSize = 64, c_maxTuneLocalWorkSize = 256, c_minTuneMultiplier = 4096, c_maxTuneMultiplier = 262144, c_maxTuneBatchMs = 400 };
 
 public:
+	enum { c_defaultPipelineDepth = 2, c_maxPipelineDepth = 16 };
+	enum { c_profileWindowMs = 2000 };
+	// longest a search goes without checking for new work or being told to stop
+	enum { c_pollMs = 100 };
 
 	struct search_hook
 	{
 		virtual ~search_hook(); // always a virtual destructor for a class with virtuals.
 
 		// reports progress, return true to abort
-		virtual bool found(h256 const* nonces, uint32_t count) = 0;
+		// _epoch and _target (upper 64 bits) are what the launch was made with.  solutions for
+		// an older challenge are passed on as well, for the stale solution stats.
+		virtual bool found(h256 const* nonces, uint32_t count, unsigned _epoch, uint64_t _target) = 0;
 		virtual bool searched(uint32_t _count, uint64_t _hashSample, uint64_t _bestHash) = 0;
 		virtual bool shouldStop() = 0;
+		// a hash below the miner's close hit threshold
+		virtual void closeHit(uint64_t _hash) = 0;
+		// called before every kernel launch.  if the work epoch has moved past _epoch, fills in
+		// the new work, its epoch and its challenge epoch.  return true to abort.
+		virtual bool newWork(unsigned& _epoch, unsigned& _challengeEpoch, bytes& _challenge, uint64_t& _target) = 0;
 	};
 
 	typedef struct
 	{
 		h256 nonce;
+		uint64_t start;		// first nonce counter of the launch
 		unsigned buf;
+		unsigned epoch;		// challenge epoch the launch was made for
+		uint64_t target;	// and its target
 	} pending_batch;
 
 
@@ -67,10 +87,14 @@ public:
 	bool buildBinary(cl::Device& _device, std::string &_outfile);
 	bool init(unsigned _platformId, unsigned _deviceId);
 	void finish();
-	void search(bytes _challenge, uint64_t _target, h160 _miningAccount, search_hook& _hook);
+	void search(unsigned _epoch, unsigned _challengeEpoch, bytes _challenge, uint64_t _target, h160 _miningAccount, search_hook& _hook);
 	void setThrottle(int _percent);
-	void checkThrottleChange(int& _throttle, int& _bufferCount);
-	uint64_t nextNonceIndex(uint64_t &_nonceIndex, bool _overrideRandom);
+	bool deviceStats(eth::DeviceStats& _stats);
+	static void setHashesPerItem(unsigned _hashes) { s_hashesPerItem = std::max(1u, _hashes); }
+	/// _autotune: tune each device at startup and save the results.  _useSaved: otherwise use
+	/// saved results when there are some for the device.
+	static void setTuning(bool _autotune, bool _useSaved) { s_autotune = _autotune; s_useSavedTuning = _useSaved; }
+	void checkThrottleChange(int& _throttle, unsigned& _bufferCount);
 
 	/* -- default values -- */
 	/// Default value of the local work size. Also known as workgroup size.
@@ -84,32 +108,174 @@ public:
 
 private:
 
+	// the part of the kernel's output buffer the host sets up before each launch.
+	struct search_header
+	{
+		uint32_t count = 0;				// solutions, including any that didn't fit
+		uint32_t overflow = 0;			// solutions that didn't fit
+		uint64_t best = ~uint64_t(0);	// lowest hash of the launch
+		uint64_t closeTarget = 0;		// hashes below this are close hits
+		uint32_t closeCount = 0;		// close hits, including any that didn't fit
+		uint32_t pad = 0;
+	};
+
+	// layout of the kernel's output buffer (OUT_* in the kernel).  solutions and close hits
+	// past the end of their arrays are only counted.
 	struct search_results
 	{
-		uint32_t solutions[c_maxSearchResults + 1];
+		search_header header;
+		uint32_t solutions[c_maxSearchResults];
+		uint32_t pad;
+		uint64_t closeHits[c_maxCloseHits][2];		// hash, work item
+	};
+
+	// a search kernel with one challenge's midstate compiled in, built in the background.
+	// the target stays a kernel argument, set at each launch.
+	struct specialized_kernel
+	{
+		std::string code;
+		Mutex x_ready;
+		bool ready = false;
+		cl::Program program;
+		cl::Kernel kernel;
+	};
+
+	// one in-flight kernel launch.  each has its own queue so the launches run back to back
+	// and can be read back independently (see search()).
+	struct pipeline_slot
+	{
+		cl::CommandQueue queue;
+		cl::Buffer searchBuffer;
+		cl::Buffer precompBuffer;
+		uint64_t precomp[25];		// host side of the non-blocking midstate upload
+		bool uploaded;				// precompBuffer holds the current midstate
+		search_header header;		// host side of the non-blocking header upload
+		cl::Event kernelEvent;		// the launch, for its profiling timestamps
+		cl::Event mapEvent;			// signalled when results can be read
+		search_results* results;
+		// copied out of the mapped buffer by the map event's callback (see drainResults).
+		ethash_cl_miner* miner;
+		bool drained;
+		unsigned found;
+		unsigned overflow;
+		uint32_t hits[c_maxSearchResults];
+		uint64_t best;
+		unsigned closeFound;
+		uint64_t closeHits[c_maxCloseHits];
 	};
 
 	static std::vector<cl::Device> getDevices(std::vector<cl::Platform> const& _platforms, unsigned _platformId);
 	static std::vector<cl::Platform> getPlatforms();
+	bool buildSearchKernel(cl::Device const& _device, unsigned _workgroupSize, std::string const& _options, int _platformId, int _computeCapability);
+	void createSearchKernel(cl::Program& _program);
+	static std::string kernelSource(unsigned _workgroupSize, int _platformId, int _computeCapability, unsigned _variant);
+	void selectVariant(cl::Device const& _device, std::string const& _key, std::string const& _options, int _platformId, int _computeCapability);
+	void specialize(uint64_t const* _precomp);
+	void buildLoop();
+	bool loadCachedProgram(cl::Device const& _device, boost::filesystem::path const& _file);
+	void saveCachedProgram(cl::Device const& _device, boost::filesystem::path const& _file);
+	void autotune(cl::Device const& _device, std::string const& _key, std::string const& _options, int _platformId, int _computeCapability);
+	static void CL_CALLBACK drainResults(cl_event _event, cl_int _status, void* _slot);
+	void waitDrained(pipeline_slot& _slot);
+	void discardPending();
+	void beginSearch(unsigned _epoch, unsigned _challengeEpoch, bytes const& _challenge, uint64_t _target, h160 _miningAccount, search_hook& _hook);
+	void setSearchWork();
+	bool step(std::chrono::steady_clock::time_point& _wake);
+	void launch();
+	bool readBack();
+	bool drainedFront() const;
+	void drive();
+	static void driverLoop();
+	void profileLaunch(cl::Event const& _kernel, uint64_t _hashes);
 
 	cl::Context m_context;
 	cl::Program m_programCL, m_programBin;
-	cl::CommandQueue m_queue[c_bufferCount];
 	cl::Kernel m_searchKernel;
-	cl::Buffer m_searchBuffer[c_bufferCount];
-	cl::Buffer m_precompBuffer[c_bufferCount];
 	unsigned m_globalWorkSize;
+	unsigned m_workgroupSize;
+	// what the search kernel was built with, for [Kernel] SpecializeKernel builds.
+	cl::Device m_clDevice;
+	std::string m_buildOptions;
+	int m_platformKind = 0;
+	int m_computeCapability = 0;
+	bool m_specialize = false;
+	unsigned m_variant = 0;		// index into c_kernelVariants
+	// one build thread per device.  it builds only the latest request, so a challenge that
+	// is replaced before its build starts is never built.
+	std::thread m_builder;
+	Mutex x_builds;
+	std::condition_variable m_buildSignal;
+	std::shared_ptr<specialized_kernel> m_nextBuild;
+	bool m_buildExit = false;
 	bool m_openclOnePointOne;
 
 	deque<pending_batch> m_pending;
 	unsigned m_buf = 0;
-	cl::Event m_mapEvents[c_bufferCount];		// events used for enqueueMapBuffer
-	search_results* m_results[c_bufferCount];
+	std::vector<pipeline_slot> m_slots;		// ring of [Kernel] PipelineDepth launches
+	// where the map callbacks signal drained results: our own, or with [Kernel] SingleThread
+	// the driver thread's.
+	Mutex x_drained;
+	std::condition_variable m_drained;
+	Mutex* m_drainLock = &x_drained;
+	std::condition_variable* m_drainSignal = &m_drained;
+
+	// everything a search keeps from one step() to the next.
+	struct search_state
+	{
+		search_hook* hook = nullptr;
+		unsigned epoch = 0;			// work epoch, bumped by any change of work
+		unsigned challengeEpoch = 0;	// GenericFarm::challengeEpoch() of the challenge
+		bytes challenge;
+		uint64_t target = 0;
+		h256 nonce;
+		uint8_t message[88];
+		uint64_t precomp[25];
+		cl::Kernel kernel;
+		std::shared_ptr<specialized_kernel> specialized;
+		int throttle = 0;			// percent throttling
+		unsigned bufferCount = 1;	// launches kept in flight
+		int kernelTime = 100;		// device run time of the latest launch, for throttling
+		int batchCount = 0;
+		uint64_t batchSize = 0;		// nonces covered by one launch
+		std::chrono::steady_clock::time_point nextLaunch;	// throttling delay
+		bool done = false;			// set by the driver thread
+	};
+	search_state m_search;
+
+	// [Kernel] SingleThread: one host thread steps the searches of every device, which share
+	// a context per platform.
+	bool m_singleThread = false;
+	static Mutex s_driverLock;
+	static std::condition_variable s_driverSignal;
+	static std::vector<ethash_cl_miner*> s_driven;
+	static bool s_driverStarted;
+	static bool s_driverChanged;
+
+	// launch timestamps (ns, device clock) gathered over a window of c_profileWindowMs.
+	struct profile_window
+	{
+		uint64_t start = 0;			// start of the first launch
+		uint64_t lastEnd = 0;		// end of the latest launch
+		uint64_t busy = 0;			// time covered by at least one launch
+		uint64_t gaps = 0;			// time between launches
+		uint64_t latency = 0;		// queued to start, summed
+		uint64_t hashes = 0;
+		unsigned launches = 0;
+	};
+	profile_window m_profile;
+	eth::DeviceStats m_deviceStats;
+	bool m_haveDeviceStats = false;
+	mutable Mutex x_deviceStats;
 
 	/// The local work size for the search
 	static unsigned s_workgroupSize;
 	/// The initial global work size for the searches
 	static unsigned s_initialGlobalWorkSize;
+	/// Nonces hashed by each work item per launch.  Above 1 the looping kernel is used.
+	static unsigned s_hashesPerItem;
+	static bool s_autotune;
+	static bool s_useSavedTuning;
+	unsigned m_hashesPerItem = 1;
 	/// The target milliseconds per batch for the search. If 0, then no adjustment will happen
 	static unsigned s_msPerBatch;
 	/// Allow CPU to appear as an OpenCL device or not. Default is false
@@ -121,9 +287,5 @@ private:
 	int m_throttle = 0;
 	mutable SharedMutex x_throttle;
 	unsigned m_device;
-	// random nonces
-	int m_nonceGeneration;
-	std::mt19937 m_randGen;
-	std::uniform_int_distribution<uint64_t> m_randDist;
 
 };
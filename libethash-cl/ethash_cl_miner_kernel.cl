@@ -12,13 +12,52 @@
 #endif
 
 #ifndef MAX_OUTPUTS
-#define MAX_OUTPUTS 63U
+#define MAX_OUTPUTS 1023U
+#endif
+
+#ifndef MAX_CLOSE_HITS
+#define MAX_CLOSE_HITS 63U
+#endif
+
+// layout of g_output, in uints.  must match search_results in ethash_cl_miner.h.
+#define OUT_COUNT			0		// solutions found, including any that didn't fit
+#define OUT_OVERFLOW		1		// solutions that didn't fit
+#define OUT_BEST			2		// ulong, lowest hash of the launch
+#define OUT_CLOSE_TARGET	4		// ulong, written by the host
+#define OUT_CLOSE_COUNT		6		// close hits found, including any that didn't fit
+#define OUT_SOLUTIONS		8
+#define OUT_CLOSE_HITS		(OUT_SOLUTIONS + MAX_OUTPUTS + 1)	// ulong pairs: hash, work item
+
+#ifdef cl_khr_int64_extended_atomics
+#pragma OPENCL EXTENSION cl_khr_int64_extended_atomics : enable
 #endif
 
 #ifndef PLATFORM
 #define PLATFORM 2
 #endif
 
+// kernel variants.  the host picks a combination per device (see c_kernelVariants in ethash_cl_miner.cpp)
+
+// 0 = whatever suits PLATFORM, 1 = 32 bit shifts, 2 = rotate() on ulong
+#ifndef KECCAK_ROTATE
+#define KECCAK_ROTATE 0
+#endif
+
+// 1 = only compute lane 0 in the last round, since that's all we look at
+#ifndef KECCAK_FINAL_ROUND
+#define KECCAK_FINAL_ROUND 0
+#endif
+
+// unroll count for the round loop.  0 = leave it to the compiler
+#ifndef KECCAK_UNROLL
+#define KECCAK_UNROLL 0
+#endif
+
+// 0 = rounds on uint2 lanes, 1 = rounds on ulong lanes
+#ifndef KECCAK_LANES
+#define KECCAK_LANES 0
+#endif
+
 // this is not the byte size, but rather number of 128 byte chunks in the dag file.  Keep in mind that
 // dag elements are 64 bytes.  DAG_SIZE = dag_byte_size / 128
 #ifndef DAG_SIZE
@@ -83,7 +122,7 @@ __constant uint2 const Keccak_f1600_RC[24] = {
 /*-----------------------------------------------------------------------------------
 * ROL2
 *----------------------------------------------------------------------------------*/
-#if PLATFORM == OPENCL_PLATFORM_NVIDIA && COMPUTE >= 35
+#if KECCAK_ROTATE == 0 && PLATFORM == OPENCL_PLATFORM_NVIDIA && COMPUTE >= 35
 
 static uint2 ROL2(const uint2 a, const int offset) {
 	uint2 result;
@@ -110,7 +149,7 @@ static uint2 ROL2_large(const uint2 vv, const int r)
 	return ROL2(vv, r);
 }
 
-#elif PLATFORM == OPENCL_PLATFORM_AMD
+#elif KECCAK_ROTATE == 0 && PLATFORM == OPENCL_PLATFORM_AMD
 
 #pragma OPENCL EXTENSION cl_amd_media_ops : enable
 
@@ -138,6 +177,25 @@ static uint2 ROL2_large(const uint2 vv, const int r)
 	return amd_bitalign((vv).yx, (vv).xy, 64 - r);
 }
 
+#elif KECCAK_ROTATE == 2
+
+static uint2 ROL2(const uint2 v, const int n)
+{
+	return as_uint2(rotate(as_ulong(v), (ulong) n));
+}
+
+// this is for r <= 32
+static uint2 ROL2_small(const uint2 vv, const int r)
+{
+	return ROL2(vv, r);
+}
+
+// this is for r > 32
+static uint2 ROL2_large(const uint2 vv, const int r)
+{
+	return ROL2(vv, r);
+}
+
 #else
 
 static uint2 ROL2(const uint2 v, const int n)
@@ -385,7 +443,15 @@ void keccak_2(uint2* state, uint first_round, uint rounds)
 {
 	uint2 C[5], D[5];
 
-
+#if KECCAK_UNROLL == 1
+#pragma unroll 1
+#elif KECCAK_UNROLL == 2
+#pragma unroll 2
+#elif KECCAK_UNROLL == 4
+#pragma unroll 4
+#elif KECCAK_UNROLL > 4
+#pragma unroll
+#endif
 	for (uint i = first_round; i < rounds; ++i)
 	{
 		C[0] = state[0] ^ state[5] ^ state[10] ^ state[15] ^ state[20];
@@ -519,6 +585,83 @@ void keccak_2(uint2* state, uint first_round, uint rounds)
 }
 
 
+/*-----------------------------------------------------------------------------------
+* keccak_ulong
+*----------------------------------------------------------------------------------*/
+// same as keccak_2, on ulong lanes (KECCAK_LANES == 1).
+#if KECCAK_LANES == 1
+static void keccak_ulong(ulong* state, uint first_round, uint rounds)
+{
+	ulong C[5], D;
+
+#if KECCAK_UNROLL == 1
+#pragma unroll 1
+#elif KECCAK_UNROLL == 2
+#pragma unroll 2
+#elif KECCAK_UNROLL == 4
+#pragma unroll 4
+#elif KECCAK_UNROLL > 4
+#pragma unroll
+#endif
+	for (uint i = first_round; i < rounds; ++i)
+	{
+		C[0] = state[0] ^ state[5] ^ state[10] ^ state[15] ^ state[20];
+		C[1] = state[1] ^ state[6] ^ state[11] ^ state[16] ^ state[21];
+		C[2] = state[2] ^ state[7] ^ state[12] ^ state[17] ^ state[22];
+		C[3] = state[3] ^ state[8] ^ state[13] ^ state[18] ^ state[23];
+		C[4] = state[4] ^ state[9] ^ state[14] ^ state[19] ^ state[24];
+
+		for (uint x = 0; x < 5; x++)
+		{
+			D = rotate(C[(x + 1) % 5], 1UL) ^ C[(x + 4) % 5];
+			state[x] ^= D;
+			state[x + 5] ^= D;
+			state[x + 10] ^= D;
+			state[x + 15] ^= D;
+			state[x + 20] ^= D;
+		}
+
+		C[0] = state[1];
+		state[1] = rotate(state[6], 44UL);
+		state[6] = rotate(state[9], 20UL);
+		state[9] = rotate(state[22], 61UL);
+		state[22] = rotate(state[14], 39UL);
+		state[14] = rotate(state[20], 18UL);
+		state[20] = rotate(state[2], 62UL);
+		state[2] = rotate(state[12], 43UL);
+		state[12] = rotate(state[13], 25UL);
+		state[13] = rotate(state[19], 8UL);
+		state[19] = rotate(state[23], 56UL);
+		state[23] = rotate(state[15], 41UL);
+		state[15] = rotate(state[4], 27UL);
+		state[4] = rotate(state[24], 14UL);
+		state[24] = rotate(state[21], 2UL);
+		state[21] = rotate(state[8], 55UL);
+		state[8] = rotate(state[16], 45UL);
+		state[16] = rotate(state[5], 36UL);
+		state[5] = rotate(state[3], 28UL);
+		state[3] = rotate(state[18], 21UL);
+		state[18] = rotate(state[17], 15UL);
+		state[17] = rotate(state[11], 10UL);
+		state[11] = rotate(state[7], 6UL);
+		state[7] = rotate(state[10], 3UL);
+		state[10] = rotate(C[0], 1UL);
+
+		for (uint y = 0; y < 25; y += 5)
+		{
+			C[0] = state[y + 0];
+			C[1] = state[y + 1];
+			state[y + 0] = bitselect(state[y + 0] ^ state[y + 2], state[y + 0], state[y + 1]);
+			state[y + 1] = bitselect(state[y + 1] ^ state[y + 3], state[y + 1], state[y + 2]);
+			state[y + 2] = bitselect(state[y + 2] ^ state[y + 4], state[y + 2], state[y + 3]);
+			state[y + 3] = bitselect(state[y + 3] ^ C[0], state[y + 3], state[y + 4]);
+			state[y + 4] = bitselect(state[y + 4] ^ C[1], state[y + 4], C[0]);
+		}
+		state[0] ^= as_ulong(Keccak_f1600_RC[i]);
+	}
+}
+#endif
+
 
 /*-----------------------------------------------------------------------------------
 * test_keccak  
@@ -553,38 +696,148 @@ __kernel void test_keccak(
 }
 
 /*-----------------------------------------------------------------------------------
-* 0xbitcoin_search
+* bitcoin0x_hash
 *----------------------------------------------------------------------------------*/
-#if PLATFORM != OPENCL_PLATFORM_NVIDIA // use maxrregs on nv
-__attribute__((reqd_work_group_size(GROUP_SIZE, 1, 1)))
+#ifdef MIDSTATE
+// a build specialized for one challenge has the midstate compiled in (25 uint2 initializers),
+// so the compiler can fold it into the first round.  g_preCompute is ignored.
+__constant uint2 c_midstate[25] = { MIDSTATE };
 #endif
-__kernel void bitcoin0x_search(
-	__constant uint2 const* g_preCompute,			// 200 bytes
-	__global volatile uint* restrict g_output,	
-	ulong target
-)
-{
-	ulong const gid = get_global_id(0);
 
+// upper 64 bits of the hash for the nonce whose bytes 12..19 are gid, byte swapped so it
+// can be compared with the target.
+static ulong bitcoin0x_hash(__constant uint2 const* g_preCompute, ulong gid)
+{
 	hash200_t state;
 
 	uint2 gid2;
 	gid2.y = (gid >> 32) & 0xffffffff;
 	gid2.x = gid & 0xffffffff;
 
+#ifdef MIDSTATE
+	keccak_first_round(state.uint2s, c_midstate, gid2);
+#else
 	keccak_first_round(state.uint2s, g_preCompute, gid2);
+#endif
 
-	keccak_2(state.uint2s, 1, 24);
-	//keccak_final_round(state.uint2s);
+#if KECCAK_LANES == 1
+	keccak_ulong(state.ulongs, 1, KECCAK_FINAL_ROUND ? 23 : 24);
+#else
+	keccak_2(state.uint2s, 1, KECCAK_FINAL_ROUND ? 23 : 24);
+#endif
+#if KECCAK_FINAL_ROUND
+	keccak_final_round(state.uint2s);
+#endif
 
 	// pick off upper 64 bits of hash and flip the bytes
-	__private ulong ulhash = as_ulong(as_uchar8(state.ulongs[0]).s76543210);
+	return as_ulong(as_uchar8(state.ulongs[0]).s76543210);
+}
 
-	if (ulhash < target) {
-		uint slot = min(MAX_OUTPUTS, atomic_inc(&g_output[0]) + 1);
-		g_output[slot] = gid;
+/*-----------------------------------------------------------------------------------
+* bitcoin0x_report
+*----------------------------------------------------------------------------------*/
+// record one hash as a close hit and/or a solution.  the launch's best is kept by the
+// caller and handed to bitcoin0x_best at the end.
+void bitcoin0x_report(__global volatile uint* g_output, uint index, ulong hash, ulong target, ulong closeTarget)
+{
+	if (hash < closeTarget) {
+		uint slot = atomic_inc(&g_output[OUT_CLOSE_COUNT]);
+		if (slot < MAX_CLOSE_HITS) {
+			__global ulong* hit = (__global ulong*) &g_output[OUT_CLOSE_HITS + slot * 4];
+			hit[0] = hash;
+			hit[1] = index;
+		}
 	}
 
+	if (hash < target) {
+		// report the work item relative to startNonce to keep it within 32 bits.
+		uint slot = atomic_inc(&g_output[OUT_COUNT]);
+		if (slot < MAX_OUTPUTS)
+			g_output[OUT_SOLUTIONS + slot] = index;
+		else
+			atomic_inc(&g_output[OUT_OVERFLOW]);
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+* bitcoin0x_best
+*----------------------------------------------------------------------------------*/
+// fold each work item's lowest hash into the launch's best: a min across the work group
+// in local memory, then one global atomic per work group.  every work item must call it.
+void bitcoin0x_best(__global volatile uint* g_output, __local ulong* s_best, ulong hash)
+{
+	uint const lid = get_local_id(0);
+	s_best[lid] = hash;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	// halving, rounded up, so GROUP_SIZE needn't be a power of 2.
+	for (uint n = GROUP_SIZE; n > 1; ) {
+		uint half = (n + 1) / 2;
+		if (lid + half < n)
+			s_best[lid] = min(s_best[lid], s_best[lid + half]);
+		barrier(CLK_LOCAL_MEM_FENCE);
+		n = half;
+	}
 
+	__global volatile ulong* best = (__global volatile ulong*) &g_output[OUT_BEST];
+	if (lid == 0 && s_best[0] < *best) {
+#ifdef cl_khr_int64_extended_atomics
+		atom_min(best, s_best[0]);
+#else
+		// upper half only, which is plenty for a best hash.
+		atomic_min(&g_output[OUT_BEST + 1], (uint) (s_best[0] >> 32));
+#endif
+	}
+}
+
+/*-----------------------------------------------------------------------------------
+* 0xbitcoin_search
+*----------------------------------------------------------------------------------*/
+#if PLATFORM != OPENCL_PLATFORM_NVIDIA // use maxrregs on nv
+__attribute__((reqd_work_group_size(GROUP_SIZE, 1, 1)))
+#endif
+__kernel void bitcoin0x_search(
+	__constant uint2 const* g_preCompute,			// 200 bytes
+	__global volatile uint* restrict g_output,
+	ulong target,
+	ulong startNonce
+)
+{
+	__local ulong s_best[GROUP_SIZE];
+	uint const index = get_global_id(0);
+	ulong const closeTarget = *(__global ulong*) &g_output[OUT_CLOSE_TARGET];
+
+	ulong const hash = bitcoin0x_hash(g_preCompute, startNonce + index);
+	bitcoin0x_report(g_output, index, hash, target, closeTarget);
+	bitcoin0x_best(g_output, s_best, hash);
 }
 
+/*-----------------------------------------------------------------------------------
+* 0xbitcoin_search_loop
+*----------------------------------------------------------------------------------*/
+// same as bitcoin0x_search, but each work item hashes _hashesPerItem nonces, so a launch
+// covers global size * _hashesPerItem nonces starting at startNonce.  the work items
+// step through them a global size apart.
+#if PLATFORM != OPENCL_PLATFORM_NVIDIA // use maxrregs on nv
+__attribute__((reqd_work_group_size(GROUP_SIZE, 1, 1)))
+#endif
+__kernel void bitcoin0x_search_loop(
+	__constant uint2 const* g_preCompute,			// 200 bytes
+	__global volatile uint* restrict g_output,
+	ulong target,
+	ulong startNonce,
+	uint hashesPerItem
+)
+{
+	__local ulong s_best[GROUP_SIZE];
+	uint const stride = get_global_size(0);
+	uint index = get_global_id(0);
+	ulong const closeTarget = *(__global ulong*) &g_output[OUT_CLOSE_TARGET];
+
+	ulong best = ~0UL;
+	for (uint i = 0; i < hashesPerItem; i++, index += stride) {
+		ulong const hash = bitcoin0x_hash(g_preCompute, startNonce + index);
+		bitcoin0x_report(g_output, index, hash, target, closeTarget);
+		best = min(best, hash);
+	}
+	bitcoin0x_best(g_output, s_best, best);
+}
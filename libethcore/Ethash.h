@@ -46,6 +46,7 @@ namespace eth
 
 class BlockInfo;
 class EthashCLHook;
+class EthashCLVerifier;
 class EthashCUDAHook;
 
 class Ethash
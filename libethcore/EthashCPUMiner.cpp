@@ -26,7 +26,9 @@
 #include <chrono>
 #include <boost/algorithm/string.hpp>
 #include <random>
-#include <libethash/sha3_cryptopp.h>
+#include <mutex>
+#include "KeccakMidstate.h"
+#include "ethminer/Misc.h"
 #if ETH_CPUID || !ETH_TRUE
 #define HAVE_STDINT_H
 #include <libcpuid/libcpuid.h>
@@ -54,56 +56,130 @@ static string jsonEncode(map<string, string> const& _m)
 
 	return ret + "}";
 }
+
+static bool identifyCPU(cpu_id_t& _data)
+{
+	if (!cpuid_present())
+		return false;
+	struct cpu_raw_data_t raw;
+	if (cpuid_get_raw_data(&raw) < 0)
+		return false;
+	return cpu_identify(&raw, &_data) >= 0;
+}
 #endif
 
-EthashCPUMiner::EthashCPUMiner(Farm* _farm, unsigned _index):
-	GenericMiner<EthashProofOfWork>(_farm, _index), Worker("miner" + toString(index()))
+// pick the widest keccak engine this CPU can run.  without libcpuid we can't tell, so stay scalar.
+static void selectKeccakEngine()
 {
+#if ETH_CPUID || !ETH_TRUE
+	struct cpu_id_t data;
+	if (identifyCPU(data))
+	{
+		bool avx512 = data.flags[CPU_FEATURE_AVX512F] && KeccakMidstate::setEngine(KeccakEngine::AVX512);
+		if (!avx512 && data.flags[CPU_FEATURE_AVX2])
+			KeccakMidstate::setEngine(KeccakEngine::AVX2);
+	}
+#endif
+	LogB << "CPU keccak engine : " << KeccakMidstate::engineName() << " (" << KeccakMidstate::lanes() << " hashes per pass)";
+}
+
+EthashCPUMiner::EthashCPUMiner(Farm* _farm, unsigned _index, unsigned _instance):
+	GenericMiner<EthashProofOfWork>(_farm, _index, _instance), Worker("miner" + toString(index()))
+{
+	static std::once_flag s_engineSelected;
+	std::call_once(s_engineSelected, selectKeccakEngine);
 }
 
 EthashCPUMiner::~EthashCPUMiner()
 {
+	// the mining thread outlives pause(), so stop it while our members are still around.
+	stopWorking();
 }
 
 void EthashCPUMiner::kickOff()
 {
 	LogF << "Trace: EthashCPUMiner::kickOff, miner[" << m_index << "]";
-	startWorking();
+	{
+		std::lock_guard<std::mutex> l(x_idle);
+		m_paused = false;
+		m_workEpoch++;
+	}
+	m_workChanged.notify_all();
+	if (!isWorking())
+		startWorking();
 }
 
 void EthashCPUMiner::pause()
 {
 	LogF << "Trace: EthashCPUMiner::pause, miner[" << m_index << "]";
-	stopWorking();
+	{
+		std::lock_guard<std::mutex> l(x_idle);
+		m_paused = true;
+		m_workEpoch++;
+	}
+	m_workChanged.notify_all();
+}
+
+bool EthashCPUMiner::swapWork()
+{
+	// the mining thread notices the new epoch between batches, no need to stop it.
+	kickOff();
+	return true;
 }
 
 void EthashCPUMiner::workLoop() {
 	LogF << "Trace: EthashCPUMiner::workLoop, miner[" << m_index << "]";
 
-	Timer batchTime;
-	unsigned hashCount = 1;
-	uint64_t batchCount = 0;
-	h256 nonce = h256::random();
-	h256 hash;
-	h160 sender(m_farm->hashingAcct);
-	bytes mix(84);
-	memcpy(&mix[0], challenge.data(), 32);
-	memcpy(&mix[32], sender.data(), 20);
-	memcpy(&mix[52], nonce.data(), 32);
-	h256* noncePtr = (h256*) &mix[52];
-
-	m_farm->setIsMining(true);
-
-	for (; !shouldStop(); hashCount++, ++(*noncePtr)) {
-		SHA3_256((const ethash_h256_t*) &hash, (const uint8_t*) mix.data(), 84);
-		if (hash < target && submitProof(*noncePtr))
-			break;
-
-		if (batchTime.elapsedMilliseconds() > 100) {
-			accumulateHashes(hashCount, batchCount++);
-			batchTime.restart();
-			hashCount = 1;
+	unsigned epoch = m_workEpoch - 1;
+	bool idle = true;
+	bytes l_challenge;
+	h256 l_target;
+	h160 sender;
+	uint64_t upperTarget = 0;
+	KeccakMidstate midstate;
+	uint64_t found[c_maxSearchResults];
+
+	while (!shouldStop()) {
+		if (m_workEpoch != epoch) {
+			epoch = currentWork(l_challenge, l_target);
+			idle = m_paused || l_challenge.empty();
+			if (!idle) {
+				LogF << "Trace: EthashCPUMiner::workLoop, new work, miner[" << m_index << "]";
+				// challenge and sender are fixed for this work package, so only the nonce dependent
+				// part of the first keccak round has to be done per hash.
+				sender = h160(m_farm->hashingAcct);
+				upperTarget = upper64OfHash(l_target);
+				midstate.init(l_challenge, sender, m_farm->nonceBase(m_index));
+				m_farm->setIsMining(true);
+			}
+		}
+
+		if (idle) {
+			std::unique_lock<std::mutex> l(x_idle);
+			m_workChanged.wait_for(l, chrono::milliseconds(100), [&]() { return m_workEpoch != epoch; });
+			continue;
 		}
+
+		uint64_t batch = m_farm->nonceBatch(m_index, c_searchBatchMs, c_searchBatchSize, c_maxSearchBatch);
+		uint64_t gid = m_farm->allocateNonces(m_index, batch);
+		unsigned count = midstate.search(gid, unsigned(batch), upperTarget, found, c_maxSearchResults);
+		if (count > c_maxSearchResults)
+		{
+			m_farm->solutionsLost(count - c_maxSearchResults);
+			count = c_maxSearchResults;
+		}
+		for (unsigned i = 0; i < count; i++) {
+			// the upper 64 bits alone can't settle a tie, so check the full hash.
+			h256 nonce = midstate.nonce(found[i]);
+			bytes hash(32);
+			keccak256_0xBitcoin(l_challenge, sender, nonce, hash);
+			if (h256(hash) < l_target && submitProof(nonce)) {
+				// wait for the next work package.
+				idle = true;
+				break;
+			}
+		}
+		addHashes(batch);
 	}
 }
 
@@ -111,13 +187,8 @@ std::string EthashCPUMiner::platformInfo()
 {
 	string baseline = toString(std::thread::hardware_concurrency()) + "-thread CPU";
 #if ETH_CPUID || !ETH_TRUE
-	if (!cpuid_present())
-		return baseline;
-	struct cpu_raw_data_t raw;
 	struct cpu_id_t data;
-	if (cpuid_get_raw_data(&raw) < 0)
-		return baseline;
-	if (cpu_identify(&raw, &data) < 0)
+	if (!identifyCPU(data))
 		return baseline;
 	map<string, string> m;
 	m["vendor"] = data.vendor_str;
@@ -23,6 +23,7 @@
 
 #pragma once
 
+#include <condition_variable>
 #include "libdevcore/Worker.h"
 #include "EthashAux.h"
 #include "Miner.h"
@@ -35,7 +36,7 @@ namespace eth
 class EthashCPUMiner: public GenericMiner<EthashProofOfWork>, Worker
 {
 public:
-	EthashCPUMiner(Farm* _farm, unsigned _index);
+	EthashCPUMiner(Farm* _farm, unsigned _index, unsigned _instance);
 	~EthashCPUMiner();
 
 	static unsigned instances() { return s_numInstances > 0 ? s_numInstances : std::thread::hardware_concurrency(); }
@@ -43,14 +44,27 @@ public:
 	static void listDevices() {}
 	static bool configureGPU(unsigned, unsigned, unsigned, unsigned, unsigned, bool, unsigned, uint64_t) { return false; }
 	static void setNumInstances(unsigned _instances) { s_numInstances = std::min<unsigned>(_instances, std::thread::hardware_concurrency()); }
+	bool hasSensors() const override { return false; }
 
 protected:
 	void kickOff() override;
 	void pause() override;
+	bool swapWork() override;
 
 private:
 	void workLoop() override;
 	static unsigned s_numInstances;
+
+	// the mining thread is started once and then stays up, idling while there's no work.
+	std::atomic<bool> m_paused = {true};
+	std::mutex x_idle;
+	std::condition_variable m_workChanged;
+
+	// nonces hashed between checks for new work: about c_searchBatchMs worth at the thread's
+	// measured rate, in multiples of c_searchBatchSize (itself a multiple of every
+	// KeccakMidstate::lanes()).
+	enum { c_searchBatchSize = 8192, c_maxSearchBatch = 1 << 22, c_searchBatchMs = 20 };
+	enum { c_maxSearchResults = 8 };
 };
 
 }
@@ -107,8 +107,8 @@ unsigned EthashCUDAMiner::s_deviceId = 0;
 unsigned EthashCUDAMiner::s_numInstances = 0;
 int EthashCUDAMiner::s_devices[16] = { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 };
 
-EthashCUDAMiner::EthashCUDAMiner(Farm* _farm, unsigned _index) :
-	GenericMiner<EthashProofOfWork>(_farm, _index),
+EthashCUDAMiner::EthashCUDAMiner(Farm* _farm, unsigned _index, unsigned _instance) :
+	GenericMiner<EthashProofOfWork>(_farm, _index, _instance),
 	Worker("cudaminer" + toString(index())),
 m_hook( new EthashCUDAHook(this))
 {
@@ -144,7 +144,7 @@ void EthashCUDAMiner::workLoop()
 		//cnote << "set work; seed: " << "#" + w.seedHash.hex().substr(0, 8) + ", target: " << "#" + w.boundary.hex().substr(0, 12);
 		if (!m_miner || m_minerSeed != w.seedHash)
 		{
-			m_device = s_devices[index()] > -1 ? s_devices[index()] : index();
+			m_device = s_devices[instance()] > -1 ? s_devices[instance()] : instance();
 
 			if (s_dagLoadMode == DAG_LOAD_MODE_SEQUENTIAL)
 			{
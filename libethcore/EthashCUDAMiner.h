@@ -37,7 +37,7 @@ namespace eth
 		friend class dev::eth::EthashCUDAHook;
 
 	public:
-		EthashCUDAMiner(Farm* _farm, unsigned _index);
+		EthashCUDAMiner(Farm* _farm, unsigned _index, unsigned _instance);
 		~EthashCUDAMiner();
 
 		static unsigned instances() 
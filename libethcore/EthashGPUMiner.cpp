@@ -26,6 +26,8 @@
 #include "EthashGPUMiner.h"
 #include <thread>
 #include <chrono>
+#include <deque>
+#include <condition_variable>
 #include <libethash-cl/ethash_cl_miner.h>
 #include "ethminer/MultiLog.h"
 #include <libethash/sha3_cryptopp.h>
@@ -39,6 +41,106 @@ namespace dev
 namespace eth
 {
 
+/*-----------------------------------------------------------------------------------
+* class EthashCLVerifier
+*----------------------------------------------------------------------------------*/
+
+// checks the GPUs' candidate solutions on the host, on a thread of its own, so that the
+// search loops only have to queue them up and can get on with feeding the GPUs.  one for
+// all GPU miners.
+
+class EthashCLVerifier
+{
+public:
+
+	static EthashCLVerifier& get()
+	{
+		static EthashCLVerifier s_verifier;
+		return s_verifier;
+	}
+
+	void push(EthashGPUMiner* _miner, h256 const& _nonce, unsigned _epoch, uint64_t _target, SteadyClock::time_point _found)
+	{
+		{
+			Guard l(x_queue);
+			if (m_queue.size() >= c_maxQueued)
+			{
+				// can only happen at a silly low difficulty.
+				LogF << "Trace: EthashCLVerifier::push, queue full, miner[" << _miner->m_index << "]";
+				_miner->m_farm->solutionsLost(1);
+				return;
+			}
+			m_queue.push_back({_miner, _nonce, _epoch, _target, _found});
+		}
+		m_queued.notify_one();
+	}
+
+	// drop _miner's queued candidates and wait for the one being checked, if it's _miner's.
+	void forget(EthashGPUMiner* _miner)
+	{
+		UniqueGuard l(x_queue);
+		m_queue.erase(std::remove_if(m_queue.begin(), m_queue.end(), [&](candidate const& c) { return c.miner == _miner; }), m_queue.end());
+		m_idle.wait(l, [&]() { return m_busy != _miner; });
+	}
+
+private:
+
+	enum { c_maxQueued = 4096 };
+
+	struct candidate
+	{
+		EthashGPUMiner* miner;
+		h256 nonce;
+		unsigned epoch;
+		uint64_t target;
+		SteadyClock::time_point found;
+	};
+
+	EthashCLVerifier()
+	{
+		m_thread = std::thread([this]() { run(); });
+	}
+
+	~EthashCLVerifier()
+	{
+		{
+			Guard l(x_queue);
+			m_stop = true;
+		}
+		m_queued.notify_one();
+		m_thread.join();
+	}
+
+	void run()
+	{
+		setThreadName("clverify");
+		UniqueGuard l(x_queue);
+		while (true)
+		{
+			m_queued.wait(l, [&]() { return m_stop || !m_queue.empty(); });
+			if (m_stop)
+				return;
+			candidate c = m_queue.front();
+			m_queue.pop_front();
+			m_busy = c.miner;
+			l.unlock();
+			c.miner->report(c.nonce, c.epoch, c.target, c.found);
+			l.lock();
+			m_busy = nullptr;
+			m_idle.notify_all();
+		}
+	}
+
+	Mutex x_queue;
+	std::condition_variable m_queued;
+	std::condition_variable m_idle;
+	std::deque<candidate> m_queue;
+	EthashGPUMiner* m_busy = nullptr;
+	bool m_stop = false;
+	std::thread m_thread;
+};
+
+
 /*-----------------------------------------------------------------------------------
 * class EthashCLHook
 *----------------------------------------------------------------------------------*/
@@ -73,13 +175,30 @@ public:
 		m_aborted = m_abort = false;
 	}
 
+	// true if a search is running that will pick up the new work by itself.
+	bool searching()
+	{
+		UniqueGuard l(x_all);
+		return !m_aborted && !m_abort;
+	}
+
+	// the search has returned or thrown.  an error exit goes through none of the callbacks
+	// below, so without this searching() stays true and pause() waits forever.
+	void finished()
+	{
+		UniqueGuard l(x_all);
+		m_aborted = true;
+	}
+
 protected:
-	virtual bool found(h256 const* _nonces, uint32_t _count) override
+	virtual bool found(h256 const* _nonces, uint32_t _count, unsigned _epoch, uint64_t _target) override
 	{
 		LogF << "Trace: EthashCLHook::found, miner[" << m_owner->m_index << "], count=" << _count;
+		// checked on the verifier thread.  a successful report clears the challenge, and 
+		// newWork() takes it from there.
+		SteadyClock::time_point now = SteadyClock::now();
 		for (uint32_t i = 0; i < _count; ++i)
-			if (m_owner->report(_nonces[i]))
-				return (m_aborted = true);
+			EthashCLVerifier::get().push(m_owner, _nonces[i], _epoch, _target, now);
 		return m_owner->shouldStop();
 	}
 
@@ -88,10 +207,17 @@ protected:
 		UniqueGuard l(x_all);
 		bool shouldStop = m_abort || m_owner->shouldStop();
 		//m_owner->setCurrentHash(_hashSample);
-		//m_owner->setBestHash(_bestHash);	// this best hash might be the same as the last one, but we're not time critical here.
+		if (_bestHash < m_owner->bestHash())
+			m_owner->setBestHash(_bestHash);
 		return (m_aborted = shouldStop);
 	}
 
+	virtual void closeHit(uint64_t _hash) override
+	{
+		LogF << "Trace: EthashCLHook::closeHit, miner[" << m_owner->m_index << "], hash = " << _hash;
+		m_owner->closeHit(_hash);
+	}
+
 	virtual bool shouldStop() override
 	{
 		UniqueGuard l(x_all);
@@ -100,6 +226,23 @@ protected:
 		return false;
 	}
 
+	virtual bool newWork(unsigned& _epoch, unsigned& _challengeEpoch, bytes& _challenge, uint64_t& _target) override
+	{
+		// done under x_all so searching() can't tell setWork() we'll pick up work we then exit without.
+		UniqueGuard l(x_all);
+		if (m_abort || m_owner->shouldStop())
+			return (m_aborted = true);
+		if (m_owner->m_workEpoch == _epoch)
+			return false;
+		h256 target;
+		_epoch = m_owner->currentWork(_challenge, target, _challengeEpoch);
+		_target = upper64OfHash(target);
+		// no challenge means we just found the solution, so wait for setWork() to restart us.
+		if (_challenge.empty())
+			return (m_aborted = true);
+		return false;
+	}
+
 private:
 	Mutex x_all;
 	bool m_abort = false;
@@ -120,8 +263,8 @@ unsigned EthashGPUMiner::s_deviceId = 0;
 unsigned EthashGPUMiner::s_numInstances = 0;
 int EthashGPUMiner::s_devices[16] = { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 };
 
-EthashGPUMiner::EthashGPUMiner(Farm* _farm, unsigned _index):
-	GenericMiner<EthashProofOfWork>(_farm, _index),
+EthashGPUMiner::EthashGPUMiner(Farm* _farm, unsigned _index, unsigned _instance):
+	GenericMiner<EthashProofOfWork>(_farm, _index, _instance),
 	Worker("openclminer" + toString(index())),
 	m_hook(new EthashCLHook(this))
 {
@@ -130,23 +273,51 @@ EthashGPUMiner::EthashGPUMiner(Farm* _farm, unsigned _index):
 EthashGPUMiner::~EthashGPUMiner()
 {
 	pause();
+	EthashCLVerifier::get().forget(this);
 	delete m_miner;
 	delete m_hook;
 }
 
-bool EthashGPUMiner::report(h256 _nonce)
+// _epoch and _target are the challenge epoch and target the nonce was found under.  the
+// target may have changed since, and the nonce only has to meet the current one.  those that
+// don't, or are for an older challenge, go to the farm's stale solution stats.
+bool EthashGPUMiner::report(h256 _nonce, unsigned _epoch, uint64_t _target, SteadyClock::time_point _found)
 {
+	SolutionRecord stale = {_nonce, int(m_index), _epoch, h256(u256(_target) << 192), _found};
+	bytes l_challenge;
+	h256 l_target;
+	unsigned challengeEpoch;
+	currentWork(l_challenge, l_target, challengeEpoch);
+	if (challengeEpoch != _epoch)
+	{
+		LogF << "Trace: EthashGPUMiner::report, stale solution, miner[" << m_index << "]";
+		m_farm->solutionStale(stale);
+		return false;
+	}
+	if (l_challenge.empty())
+	{
+		LogF << "Trace: EthashGPUMiner::report, challenge already solved, miner[" << m_index << "]";
+		return false;
+	}
+
 	// verify the solution
 	h160 sender(m_farm->hashingAcct);
 	bytes hash(32);
-	keccak256_0xBitcoin(challenge, sender, _nonce, hash);
+	keccak256_0xBitcoin(l_challenge, sender, _nonce, hash);
 
-	LogF << "Trace: EthashGPUMiner::report, challenge = " << toHex(challenge) << ", sender = " << sender.hex()
-		<< ", nonce = " << _nonce.hex() << ", hash = " << toHex(hash) << ", target = " << target.hex() << ", miner[" << m_index << "]";
+	LogF << "Trace: EthashGPUMiner::report, challenge = " << toHex(l_challenge) << ", sender = " << sender.hex()
+		<< ", nonce = " << _nonce.hex() << ", hash = " << toHex(hash) << ", target = " << l_target.hex() << ", miner[" << m_index << "]";
 
-	if (h256(hash) < target)
+	if (h256(hash) < l_target)
 		return submitProof(_nonce);
+	if (upper64OfHash(h256(hash)) < _target)
+	{
+		LogF << "Trace: EthashGPUMiner::report, solution no longer meets the target, miner[" << m_index << "]";
+		m_farm->solutionStale(stale);
+		return false;
+	}
 	LogB << "Solution found, but invalid.  Possible hash fault.";
+	m_farm->reportHashFault(m_index);
 	return false;
 }
 
@@ -164,19 +335,28 @@ void EthashGPUMiner::kickOff()
 	startWorking();
 }
 
+bool EthashGPUMiner::swapWork()
+{
+	// a running search checks the work epoch before each kernel launch.
+	return m_hook->searching();
+}
+
 void EthashGPUMiner::workLoop()
 {
 	LogF << "Trace: EthashGPUMiner::workLoop-1, miner[" << m_index << "]";
 	try {
 		// take local copy of work since it may end up being overwritten by kickOff/pause.
-		WorkPackage w = work();
+		bytes l_challenge;
+		h256 l_target;
+		unsigned challengeEpoch;
+		unsigned epoch = currentWork(l_challenge, l_target, challengeEpoch);
 		if (!m_miner)
 		{
 			LogF << "Trace: EthashGPUMiner::workLoop-2, miner[" << m_index << "]";
 			LogS << "Initialising miner[" << m_index << "]";
 
 			m_miner = new ethash_cl_miner(this);
-			m_device = s_devices[index()] > -1 ? s_devices[index()] : index();
+			m_device = s_devices[instance()] > -1 ? s_devices[instance()] : instance();
 
 			if (!m_miner->init(s_platformId, m_device))
 				throw cl::Error(-1, "cl_miner.init failed!");
@@ -186,15 +366,11 @@ void EthashGPUMiner::workLoop()
 
 		m_farm->setIsMining(true);
 
-		uint64_t startN = 0;
-		if (w.exSizeBits >= 0)
-			startN = w.startNonce | ((uint64_t)index() << (64 - 4 - w.exSizeBits)); // this can support up to 16 devices
-
-		uint64_t threshold = upper64OfHash(target);
+		uint64_t threshold = upper64OfHash(l_target);
 
 		//m_miner->verifyHashes();
 
-		m_miner->search(challenge, threshold, h160(m_farm->hashingAcct), *m_hook);
+		m_miner->search(epoch, challengeEpoch, l_challenge, threshold, h160(m_farm->hashingAcct), *m_hook);
 	}
 	catch (cl::Error const& _e)
 	{
@@ -202,6 +378,7 @@ void EthashGPUMiner::workLoop()
 		m_miner = nullptr;
 		LogB << "Error GPU mining: " << _e.what() << "(" << _e.err() << ")";
 	}
+	m_hook->finished();
 	LogF << "Trace: EthashGPUMiner::workLoop-exit, miner[" << m_index << "]";
 }
 
@@ -282,6 +459,21 @@ bool EthashGPUMiner::configureGPU(
 	return true;
 }
 
+void EthashGPUMiner::setHashesPerItem(unsigned _hashes)
+{
+	ethash_cl_miner::setHashesPerItem(_hashes);
+}
+
+void EthashGPUMiner::setTuning(bool _autotune, bool _useSaved)
+{
+	ethash_cl_miner::setTuning(_autotune, _useSaved);
+}
+
+bool EthashGPUMiner::deviceStats(DeviceStats& _stats)
+{
+	return m_miner && m_miner->deviceStats(_stats);
+}
+
 void EthashGPUMiner::setThrottle(int _percent)
 {
 	if (m_farm->isMining())
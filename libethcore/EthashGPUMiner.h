@@ -36,9 +36,10 @@ namespace eth
 class EthashGPUMiner: public GenericMiner<EthashProofOfWork>, Worker
 {
 	friend class dev::eth::EthashCLHook;
+	friend class dev::eth::EthashCLVerifier;
 
 public:
-	EthashGPUMiner(Farm* _farm, unsigned _index);
+	EthashGPUMiner(Farm* _farm, unsigned _index, unsigned _instance);
 	~EthashGPUMiner();
 
 	static unsigned instances() { return s_numInstances > 0 ? s_numInstances : 1; }
@@ -64,16 +65,20 @@ public:
 			s_devices[i] = _devices[i];
 		}
 	}
+	static void setHashesPerItem(unsigned _hashes);
+	static void setTuning(bool _autotune, bool _useSaved);
 	void setThrottle(int _percent);
+	bool deviceStats(DeviceStats& _stats) override;
 	void checkHash(uint64_t _hash, uint64_t _nonce, h256 _header);
 
 protected:
 	void kickOff() override;
 	void pause() override;
+	bool swapWork() override;
 
 private:
 	void workLoop() override;
-	bool report(h256 _nonce);
+	bool report(h256 _nonce, unsigned _epoch, uint64_t _target, SteadyClock::time_point _found);
 	void resetBestHash();
 
 	EthashCLHook* m_hook = nullptr;
@@ -24,6 +24,8 @@
 #include <thread>
 #include <list>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include <libdevcore/Common.h>
 #include <libdevcore/Worker.h>
 #include <libethcore/Common.h>
@@ -60,9 +62,10 @@ public:
 	using SolutionProcessedFn = boost::function<bool(unsigned, SolutionState, bool, int)>;
 	using CloseHitFn = boost::function<bool(uint64_t const, unsigned const, int const)>;
 	using HashFaultFn = boost::function<bool(int const)>;
+	using SolutionQueuedFn = std::function<void()>;
 
 	using CountInstancesFn = std::function<unsigned()>;
-	using CreateInstanceFn = std::function<GenericMiner<PoW>*(GenericFarm<PoW>* _farm, unsigned _index)>;
+	using CreateInstanceFn = std::function<GenericMiner<PoW>*(GenericFarm<PoW>* _farm, unsigned _index, unsigned _instance)>;
 
 	typedef std::vector<GenericMiner<PoW>*> miners_t;
 
@@ -74,33 +77,53 @@ public:
 	{
 	public:
 
-		// this maintains hashrates per miner. all rates are MH/s. 
-		// you need to call update before retrieving farmRate or minerRates.
+		// this maintains hashrates per miner. all rates are MH/s.  a sampler thread reads the
+		// miners' hash counters once a second and publishes the rates, so reading them never
+		// takes a lock or touches the miners.  it also keeps a short history of rates at 1 second
+		// and 1 minute resolution.
 
-		HashRates(GenericFarm<PoW>* _f) : m_farm(_f) {}
+		enum { c_sampleMs = 1000, c_historySize = 60 };
 
-		void init()
+		struct RateSample
+		{
+			int64_t time;					// seconds since the epoch
+			float farmRate;
+			std::vector<float> minerRates;
+		};
+
+		HashRates(GenericFarm<PoW>* _f) : m_farm(_f), m_set(std::make_shared<MinerSet>()) {}
+
+		~HashRates()
 		{
-			for (std::size_t i = 0; i < m_farm->minerCount(); i++)
-				m_minerRates.push_back(EMA(3));
+			stopSampler();
 		}
 
-		/**
-		* @brief gather and compute latest hash rates. 
-		*/
-		void update()
+		// (re)starts sampling the farm's miners.  call without holding x_minerWork.  if the
+		// number of miners has changed, the rates and the history start over.
+		void init()
 		{
-			WriteGuard l(x_hashRates);
-			m_farmRate = 0;
-			std::string rates;
-			for (std::size_t i = 0; i < m_farm->minerCount(); i++)
+			unsigned count;
 			{
-				m_minerRates[i].newVal(m_farm->m_miners[i]->getHashRate());
-				rates.append(toString(m_minerRates[i].value()) + ", ");
-				m_farmRate += m_minerRates[i].value();
+				ReadGuard l(m_farm->x_minerWork);
+				count = m_farm->m_miners.size();
 			}
-			rates.resize(rates.size() - 2);
-			LogF << "HashRates.update: " << m_farmRate << " [" << rates << "]";
+			if (m_sampler.joinable())
+			{
+				if (count == minerSet()->count)
+					return;
+				stopSampler();
+			}
+			auto set = std::make_shared<MinerSet>();
+			set->count = count;
+			set->rates.reset(new std::atomic<float>[count]);
+			for (unsigned i = 0; i < count; i++)
+				set->rates[i] = 0;
+			set->seconds.init(count);
+			set->minutes.init(count);
+			std::atomic_store(&m_set, set);
+			m_farmRate = 0;
+			m_stopSampler = false;
+			m_sampler = std::thread([this, set]() { samplerLoop(*set); });
 		}
 
 		friend std::ostream& operator<< (std::ostream &out, const HashRates &rates)
@@ -108,13 +131,13 @@ public:
 			std::string sep;
 			char szBuff[20];
 
-			ReadGuard l(rates.x_hashRates);
-			sprintf(szBuff, " %.1f", rates.m_farmRate);
+			sprintf(szBuff, " %.1f", rates.farmRate());
 			out << szBuff << " MH/s";
-			if (rates.m_minerRates.size() > 1)
+			unsigned count = rates.minerSet()->count;
+			if (count > 1)
 			{
 				out << " [";
-				for (std::size_t i = 0; i < rates.m_farm->minerCount(); i++)
+				for (unsigned i = 0; i < count; i++)
 				{
 					sprintf(szBuff, "%.1f", rates.minerRate(i));
 					out << sep << szBuff;
@@ -127,37 +150,56 @@ public:
 			return out;
 		}
 
-		float farmRate() 
+		float farmRate() const
 		{ 
-			ReadGuard l(x_hashRates); 
-			return m_farmRate; 
+			return m_farmRate.load(std::memory_order_relaxed);
 		}
 
 		float minerRate(int _miner) const
 		{ 
-			ReadGuard l(x_hashRates); 
-			return m_minerRates[_miner].value();
+			auto set = minerSet();
+			return unsigned(_miner) < set->count ? set->rates[_miner].load(std::memory_order_relaxed) : 0;
+		}
+
+		// the farm rate averaged over the last _seconds seconds (as many as we have).
+		float averageRate(unsigned _seconds) const
+		{
+			std::vector<RateSample> samples;
+			history(samples, false);
+			float sum = 0;
+			unsigned n = 0;
+			for (auto it = samples.rbegin(); it != samples.rend() && n < _seconds; ++it, ++n)
+				sum += it->farmRate;
+			return n ? sum / n : 0;
+		}
+
+		// up to c_historySize samples, oldest first.  _minutes for 1 minute averages, otherwise
+		// 1 second samples.
+		void history(std::vector<RateSample>& _samples, bool _minutes) const
+		{
+			auto set = minerSet();
+			(_minutes ? set->minutes : set->seconds).read(_samples);
 		}
 
 		// return true if any of the miner hash rates have changed by more than _delta.  
-		// you need to call update() first before calling this.
 		// currently there is no support for obtaining delta change info on the farm rate.
 		void deltaExceeded(float _delta, bool& _deltaExceeded)
 		{
 			_deltaExceeded = false;
 
-			if (m_lastReportedRate.size() == 0)
+			unsigned count = minerSet()->count;
+			if (m_lastReportedRate.size() != count)
 			{
-				// first time here. fill lastReported vectors with zeros.
-				m_lastReportedRate.assign(m_farm->minerCount(), 0);
+				// first time here, or a new set of miners. fill lastReported vectors with zeros.
+				m_lastReportedRate.assign(count, 0);
 			}
 
-			for (int i = 0; i < m_minerRates.size(); i++)
+			for (unsigned i = 0; i < count; i++)
 			{
-				if (abs(m_minerRates[i].value() - m_lastReportedRate[i]) >= _delta)
+				if (abs(minerRate(i) - m_lastReportedRate[i]) >= _delta)
 				{
 					_deltaExceeded = true;
-					m_lastReportedRate[i] = m_minerRates[i].value();
+					m_lastReportedRate[i] = minerRate(i);
 				}
 			}
 		}
@@ -165,10 +207,162 @@ public:
 		GenericFarm<PoW>* m_farm = nullptr;
 
 	private:
-		mutable SharedMutex x_hashRates;
-		std::vector<EMA> m_minerRates;
+
+		// one resolution of the history.  written by the sampler thread only, and read without
+		// locking.  values are atomics so a reader racing the writer gets old or new values, never
+		// torn ones, and read() drops whatever the writer may have overwritten while it copied.
+		// there's one slot more than read() returns: m_count is only bumped once a slot has been
+		// written, so the slot the next push() reuses has to be left out.
+		class SampleRing
+		{
+		public:
+			enum { c_slots = c_historySize + 1 };
+
+			void init(unsigned _miners)
+			{
+				m_width = _miners + 1;
+				m_rates.reset(new std::atomic<float>[c_slots * m_width]);
+				for (unsigned i = 0; i < c_slots * m_width; i++)
+					m_rates[i] = 0;
+			}
+
+			// _rates[0] is the farm rate, then one per miner.
+			void push(int64_t _time, float const* _rates)
+			{
+				uint64_t n = m_count.load(std::memory_order_relaxed);
+				unsigned slot = n % c_slots;
+				// pairs with the fence in read(): a reader that sees any of the stores below
+				// also sees the count published by the previous push.
+				std::atomic_thread_fence(std::memory_order_release);
+				m_times[slot].store(_time, std::memory_order_relaxed);
+				for (unsigned i = 0; i < m_width; i++)
+					m_rates[slot * m_width + i].store(_rates[i], std::memory_order_relaxed);
+				m_count.store(n + 1, std::memory_order_release);
+			}
+
+			void read(std::vector<RateSample>& _samples) const
+			{
+				_samples.clear();
+				uint64_t end = m_count.load(std::memory_order_acquire);
+				uint64_t begin = end > c_historySize ? end - c_historySize : 0;
+				for (uint64_t n = begin; n < end; n++)
+				{
+					unsigned slot = n % c_slots;
+					RateSample s;
+					s.time = m_times[slot].load(std::memory_order_relaxed);
+					s.farmRate = m_rates[slot * m_width].load(std::memory_order_relaxed);
+					for (unsigned i = 1; i < m_width; i++)
+						s.minerRates.push_back(m_rates[slot * m_width + i].load(std::memory_order_relaxed));
+					_samples.push_back(s);
+				}
+				// the oldest slots may have been reused meanwhile.
+				std::atomic_thread_fence(std::memory_order_acquire);
+				uint64_t overwritten = m_count.load(std::memory_order_relaxed) - end;
+				_samples.erase(_samples.begin(), _samples.begin() + std::min<uint64_t>(overwritten, _samples.size()));
+			}
+
+		private:
+			unsigned m_width = 1;
+			std::unique_ptr<std::atomic<float>[]> m_rates;
+			std::atomic<int64_t> m_times[c_slots];
+			std::atomic<uint64_t> m_count = {0};
+		};
+
+		// everything sized by the number of miners.  init() replaces it as a whole when the farm
+		// is started with a different number of miners, and readers keep the one they took.
+		struct MinerSet
+		{
+			unsigned count = 0;
+			std::unique_ptr<std::atomic<float>[]> rates;
+			SampleRing seconds;
+			SampleRing minutes;
+		};
+
+		std::shared_ptr<MinerSet> minerSet() const
+		{
+			return std::atomic_load(&m_set);
+		}
+
+		void stopSampler()
+		{
+			{
+				std::lock_guard<std::mutex> l(x_sampler);
+				m_stopSampler = true;
+			}
+			m_samplerSignal.notify_all();
+			if (m_sampler.joinable())
+				m_sampler.join();
+		}
+
+		void samplerLoop(MinerSet& _set)
+		{
+			unsigned const count = _set.count;
+			std::vector<EMA> smoothed(count, EMA(6));
+			std::vector<uint64_t> lastDone(count, 0);
+			std::vector<bool> haveLast(count, false);
+			// unsmoothed, farm rate first, then per miner, for the rings.  only the published
+			// rates are smoothed.
+			std::vector<float> raw(count + 1, 0), minuteSum(count + 1, 0);
+			unsigned minuteCount = 0;
+			SteadyClock::time_point lastSample = SteadyClock::now();
+
+			std::unique_lock<std::mutex> l(x_sampler);
+			while (!m_samplerSignal.wait_for(l, std::chrono::milliseconds(c_sampleMs), [&]() { return m_stopSampler; }))
+			{
+				SteadyClock::time_point now = SteadyClock::now();
+				double elapsed = std::chrono::duration<double, std::micro>(now - lastSample).count();
+				lastSample = now;
+				{
+					ReadGuard lm(m_farm->x_minerWork);
+					if (m_farm->m_miners.size() < count)
+						continue;		// stopped
+					float farmRate = 0;
+					for (unsigned i = 0; i < count; i++)
+					{
+						// hashes per microsecond is MH/s.  a restart means the count since the last
+						// sample isn't representative (see GenericMiner::accumulateHashes), so the
+						// rates are left where they were.
+						bool restart;
+						uint64_t done = m_farm->m_miners[i]->hashesDone(restart);
+						if (!restart && haveLast[i] && elapsed > 0)
+						{
+							raw[i + 1] = float((done - lastDone[i]) / elapsed);
+							smoothed[i].newVal(raw[i + 1]);
+						}
+						lastDone[i] = done;
+						haveLast[i] = true;
+						_set.rates[i].store(smoothed[i].value(), std::memory_order_relaxed);
+						farmRate += smoothed[i].value();
+					}
+					raw[0] = 0;
+					for (unsigned i = 1; i <= count; i++)
+						raw[0] += raw[i];
+					m_farmRate.store(farmRate, std::memory_order_relaxed);
+				}
+
+				int64_t time = std::chrono::duration_cast<std::chrono::seconds>(SystemClock::now().time_since_epoch()).count();
+				_set.seconds.push(time, raw.data());
+				for (unsigned i = 0; i <= count; i++)
+					minuteSum[i] += raw[i];
+				if (++minuteCount == 60000 / c_sampleMs)
+				{
+					for (auto& sum : minuteSum)
+						sum /= minuteCount;
+					_set.minutes.push(time, minuteSum.data());
+					minuteSum.assign(count + 1, 0);
+					minuteCount = 0;
+				}
+			}
+		}
+
+		std::shared_ptr<MinerSet> m_set;
+		std::atomic<float> m_farmRate = {0};
 		std::vector<float> m_lastReportedRate;	// used for delta change calculations
-		float m_farmRate = 0;
+
+		std::thread m_sampler;
+		std::mutex x_sampler;
+		std::condition_variable m_samplerSignal;
+		bool m_stopSampler = false;
 
 	};	// class HashRates
 
@@ -186,11 +380,19 @@ public:
 			closeHitThreshold = std::stoull(ProgOpt::Get("CloseHits", "CloseHitThreshold").c_str());
 			workUnitFreq = std::stoull(ProgOpt::Get("CloseHits", "WorkUnitFrequency").c_str());
 		}
+		// rigs sharing a pool account need different prefixes or they will search the same nonces.
+		std::string rigPrefix = ProgOpt::Get("General", "RigPrefix");
+		if (rigPrefix.empty())
+			memcpy(&m_rigPrefix, h64::random().data(), 8);
+		else
+			m_rigPrefix = HexToInt(rigPrefix);
+		LogF << "Trace: GenericFarm : rig prefix = " << std::hex << m_rigPrefix;
 	}
 
 	~GenericFarm()
 	{
 		stop();
+		delete m_hashRates;
 	}
 
 
@@ -206,28 +408,90 @@ public:
 		WriteGuard l(x_minerWork);
 		if (_challenge == m_challenge && _target == m_target)
 			return;
+		if (_target != m_target)
+			m_targetChanged = SteadyClock::now();
 		m_challenge = _challenge;
 		m_target = _target;
+		if (!_challenge.empty() && _challenge != m_nonceChallenge)
+		{
+			m_challengeEpoch++;
+			m_challengeChanged[m_challengeEpoch % c_epochHistory] = SteadyClock::now();
+			// new challenge, so the whole nonce space is fresh again. a change of target or a
+			// pause doesn't count, we just carry on from where we were.
+			m_nonceChallenge = _challenge;
+			for (std::size_t i = 0; i < m_miners.size(); i++)
+				m_nonceCursors[i] = 0;
+		}
 		for (auto const& m: m_miners)
 			m->setWork(m_challenge, m_target);
 	}
 
 
+	/*-----------------------------------------------------------------------------------
+	* nonceBase
+	*----------------------------------------------------------------------------------*/
+	h256 nonceBase(unsigned _miner)
+	{
+		// nonce layout:
+		//		bytes  0..7		rig prefix
+		//		bytes  8..11	miner index
+		//		bytes 12..19	search counter, handed out by allocateNonces.  this is lane 8 of
+		//						the keccak message, where the kernel puts its work item id.
+		//		bytes 20..31	zero
+		// so every miner on every rig has its own range of 2^64 nonces per challenge.
+		h256 nonce;
+		uint32_t slot = _miner;
+		memcpy(nonce.data(), &m_rigPrefix, 8);
+		memcpy(nonce.data() + 8, &slot, 4);
+		return nonce;
+	}
+
+	/*-----------------------------------------------------------------------------------
+	* allocateNonces
+	*----------------------------------------------------------------------------------*/
+	uint64_t allocateNonces(unsigned _miner, uint64_t _count)
+	{
+		// returns the first of _count search counter values the miner should hash next.  the
+		// counters only go back to zero when the challenge changes.
+		return m_nonceCursors[_miner].fetch_add(_count, std::memory_order_relaxed);
+	}
+
+	/*-----------------------------------------------------------------------------------
+	* nonceBatch
+	*----------------------------------------------------------------------------------*/
+	uint64_t nonceBatch(unsigned _miner, unsigned _ms, uint64_t _granule, uint64_t _max)
+	{
+		// how many nonces to give a miner that sizes its own batches, so that a batch takes
+		// about _ms at the miner's measured rate.  a multiple of _granule, at least one.  in a
+		// farm mixing fast and slow miners this keeps every miner checking for new work about
+		// as often, without the slow ones paying for tiny batches or the fast ones going stale.
+		uint64_t n = uint64_t(m_hashRates->minerRate(_miner) * 1000.0 * _ms) / _granule * _granule;
+		return std::min(std::max(n, _granule), _max);
+	}
+
+
 	/*-----------------------------------------------------------------------------------
 	* start
 	*----------------------------------------------------------------------------------*/
 	void start(const miners_t& _miners)
 	{
 		LogF << "Trace: GenericFarm.start";
-		WriteGuard l(x_minerWork);
-		m_miners = _miners;
-		m_hashFaults.assign(m_miners.size(), 0);
-
-		m_bestHash = logger.retrieveBestHash();
+		{
+			WriteGuard l(x_minerWork);
+			m_miners = _miners;
+			m_hashFaults.assign(m_miners.size(), 0);
+			m_staleTimes.assign(m_miners.size(), StaleTimes());
+			m_nonceCursors.reset(new std::atomic<uint64_t>[m_miners.size()]);
+			for (std::size_t i = 0; i < m_miners.size(); i++)
+				m_nonceCursors[i] = 0;
+
+			m_bestHash = logger.retrieveBestHash();
+			// can't call setWork until we've initialized the hash rates
+			//for (auto const& m : m_miners)
+			//	m->setWork_token(m_challenge, m_target);
+		}
+		// outside the lock, since it may have to wait for the sampler, which takes it.
 		m_hashRates->init();
-		// can't call setWork until we've initialized the hash rates
-		//for (auto const& m : m_miners)
-		//	m->setWork_token(m_challenge, m_target);
 
 		LogF << "Trace: GenericFarm.start [exit]";
 	}
@@ -393,6 +657,17 @@ public:
 			logger.recordHashFault(_miner);
 	}
 
+	/*-----------------------------------------------------------------------------------
+	* onSolutionQueued
+	*----------------------------------------------------------------------------------*/
+	void onSolutionQueued(SolutionQueuedFn const& _handler)
+	{
+		// set a handler called on the miner's thread each time a solution is queued, so the
+		// main loop can pick it up (solutionsFound) straight away.  it should only hand off.
+		Guard l(x_onSolutionQueued);
+		m_onSolutionQueued = _handler;
+	}
+
 	/*-----------------------------------------------------------------------------------
 	* onHashFault
 	*----------------------------------------------------------------------------------*/
@@ -438,26 +713,29 @@ public:
 		// we're being notified (typically by the main loop) as to the acceptance
 		// state of a recent solution.
 
-		if (_state == SolutionState::Accepted)
-		{
-			//LogB << ":) Submitted and accepted.";
-			if (_stale)
-				m_solutionStats.acceptedStale();
-			else
-				m_solutionStats.accepted();
-		}
-		else if (_state == SolutionState::Rejected)
 		{
-			//LogB << ":-( Not accepted.";
-			if (_stale)
-				m_solutionStats.rejectedStale();
+			WriteGuard l(x_solutionStats);
+			if (_state == SolutionState::Accepted)
+			{
+				//LogB << ":) Submitted and accepted.";
+				if (_stale)
+					m_solutionStats.acceptedStale();
+				else
+					m_solutionStats.accepted();
+			}
+			else if (_state == SolutionState::Rejected)
+			{
+				//LogB << ":-( Not accepted.";
+				if (_stale)
+					m_solutionStats.rejectedStale();
+				else
+					m_solutionStats.rejected();
+			}
 			else
-				m_solutionStats.rejected();
-		}
-		else
-		{
-			//LogB << "FAILURE: GPU gave incorrect result!";
-			m_solutionStats.failed();
+			{
+				//LogB << "FAILURE: GPU gave incorrect result!";
+				m_solutionStats.failed();
+			}
 		}
 
 		resetBestHash();
@@ -465,6 +743,51 @@ public:
 	}	// recordSolution
 
 
+	/*-----------------------------------------------------------------------------------
+	* solutionsLost
+	*----------------------------------------------------------------------------------*/
+	void solutionsLost(unsigned _count)
+	{
+		// a GPU found more solutions in one kernel run than its results buffer holds. only
+		// likely with a very low pool difficulty.  called from the GPU and CPU mining threads.
+		WriteGuard l(x_solutionStats);
+		m_solutionStats.lost(_count);
+	}
+
+	/*-----------------------------------------------------------------------------------
+	* solutionStale
+	*----------------------------------------------------------------------------------*/
+	void solutionStale(SolutionRecord const& _s)
+	{
+		// a solution for a challenge or target we've since moved on from.  it gets dropped
+		// without being sent, and we note how long after the change the device found it.
+		SteadyClock::time_point changed;
+		{
+			ReadGuard l(x_minerWork);
+			changed = _s.epoch != m_challengeEpoch ? m_challengeChanged[(_s.epoch + 1) % c_epochHistory] : m_targetChanged;
+		}
+		int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(_s.found - changed).count();
+
+		WriteGuard l(x_solutionStats);
+		m_solutionStats.dropped();
+		if (_s.miner >= 0 && _s.miner < int(m_staleTimes.size()))
+		{
+			m_staleTimes[_s.miner].record(ms);
+			LogD << "Stale solution dropped, miner[" << _s.miner << "], found " << ms << " ms after the work changed.  So far: "
+				<< m_staleTimes[_s.miner];
+		}
+	}
+
+	/*-----------------------------------------------------------------------------------
+	* getStaleTimes
+	*----------------------------------------------------------------------------------*/
+	void getStaleTimes(std::vector<StaleTimes>& _times)
+	{
+		// per miner
+		ReadGuard l(x_solutionStats);
+		_times = m_staleTimes;
+	}
+
 	/*-----------------------------------------------------------------------------------
 	* resetBestHash
 	*----------------------------------------------------------------------------------*/
@@ -481,6 +804,7 @@ public:
 	* getSolutionStats
 	*----------------------------------------------------------------------------------*/
 	SolutionStats getSolutionStats() {
+		ReadGuard l(x_solutionStats);
 		return m_solutionStats;
 	}
 	
@@ -553,6 +877,45 @@ public:
 		return s.str();
 	}
 
+	/*-----------------------------------------------------------------------------------
+	* getDeviceStats (overloaded)
+	*----------------------------------------------------------------------------------*/
+	void getDeviceStats(std::vector<DeviceStats>& _stats)
+	{
+		// miners that don't measure device timings are left at zero.
+		_stats.clear();
+		for (auto const& m : m_miners)
+		{
+			DeviceStats s;
+			m->deviceStats(s);
+			_stats.push_back(s);
+		}
+	}
+
+	/*-----------------------------------------------------------------------------------
+	* getDeviceStats (overloaded)
+	*----------------------------------------------------------------------------------*/
+	std::string getDeviceStats()
+	{
+		// formatted for screen output: busy percent per device, empty if no device measures it.
+		std::string sep;
+		std::stringstream s;
+		bool any = false;
+		for (auto const& m : m_miners)
+		{
+			DeviceStats d;
+			if (m->deviceStats(d))
+			{
+				s << sep << int(d.busy + 0.5) << "%";
+				any = true;
+			}
+			else
+				s << sep << "-";
+			sep = ", ";
+		}
+		return any ? s.str() : "";
+	}
+
 	/*-----------------------------------------------------------------------------------
 	* setGpuThrottle
 	*----------------------------------------------------------------------------------*/
@@ -603,64 +966,82 @@ public:
 	/*-----------------------------------------------------------------------------------
 	* submitProof
 	*----------------------------------------------------------------------------------*/
-	bool submitProof(h256 _nonce, Miner* _m) 
+	bool submitProof(h256 _nonce, Miner* _m, unsigned _epoch, h256 const& _target)
 	{
-		// return true if miner should stop and wait for new work, false to keep mining
-
-		bool shouldStop = false;
+		// return true if miner should stop and wait for new work, false to keep mining.  _epoch
+		// and _target are what the miner was working on when it found the solution.
 
 		LogF << "Trace: GenericFarm.submitProof - nonce = " << _nonce.hex().substr(0, 8) << ", miner = " << _m->index();
 
-		/*
-			we could block here if 
-			   - another miner found a solution and is submitting it
-			   - the main loop is checking if a solution has been found
-			   - setWork has been called with a new work package
-		*/
-
-		Guard l(x_solution);
-
-		// check to see if the main loop is still processing a previous solution
-		if (solutionMiner == -1)
+		SolutionRecord s = {_nonce, int(_m->index()), _epoch, _target, SteadyClock::now()};
+		if (_epoch != m_challengeEpoch)
 		{
-			LogF << "Trace: GenericFarm.submitProof - setting new solution";
-			solutionMiner = _m->index();
-			solution = _nonce;
-			if (m_opMode == OperationMode::Solo)
-			{
-				WriteGuard lck(x_minerWork);
-				m_challenge.clear();
-				for (auto const& m : m_miners)
-					if (m != _m)
-						m->setWork(m_challenge, m_target);
-				shouldStop = true;
-			} else
-				shouldStop = false;
-		} else
+			// the miner hasn't picked up the new challenge yet.  in solo mode in particular this
+			// mustn't stop the other miners.
+			solutionStale(s);
+			return false;
+		}
+		if (m_opMode != OperationMode::Solo)
 		{
-			LogF << "Trace: GenericFarm.submitProof - previous solution not processed";
-			shouldStop = m_opMode == OperationMode::Solo;
+			// pool shares just go in the queue, however many miners are finding them at once.
+			if (m_solutions.push(s))
+				solutionQueued();
+			else
+			{
+				LogF << "Trace: GenericFarm.submitProof - solution queue full";
+				solutionsLost(1);
+			}
+			return false;
 		}
 
-		return shouldStop;
-
+		// solo: the first solution for a challenge stops all the miners until there's new work.
+		WriteGuard lck(x_minerWork);
+		if (m_challenge.empty())
+		{
+			LogF << "Trace: GenericFarm.submitProof - challenge already solved";
+			return true;
+		}
+		if (m_solutions.push(s))
+		{
+			m_challenge.clear();
+			for (auto const& m : m_miners)
+				if (m != _m)
+					m->setWork(m_challenge, m_target);
+			solutionQueued();
+		}
+		return true;
 	}
 
-
-	bool solutionFound(h256& _solution, int& _miner)
+	/*-----------------------------------------------------------------------------------
+	* solutionQueued
+	*----------------------------------------------------------------------------------*/
+	void solutionQueued()
 	{
-		// check if any of the miners has found a solution
+		Guard l(x_onSolutionQueued);
+		if (m_onSolutionQueued)
+			m_onSolutionQueued();
+	}
 
-		Guard l(x_solution);
+	/*-----------------------------------------------------------------------------------
+	* solutionsFound
+	*----------------------------------------------------------------------------------*/
+	bool solutionsFound(std::vector<SolutionRecord>& _solutions)
+	{
+		// add everything the miners have queued up to _solutions, and return true if there's
+		// anything to submit.  main loop only.
+		SolutionRecord s;
+		while (m_solutions.pop(s))
+			_solutions.push_back(s);
+		return !_solutions.empty();
+	}
 
-		if (solutionMiner != -1)
-		{
-			_miner = solutionMiner;
-			_solution = solution;
-			solutionMiner = -1;
-			return true;
-		} else
-			return false;
+	/*-----------------------------------------------------------------------------------
+	* challengeEpoch
+	*----------------------------------------------------------------------------------*/
+	unsigned challengeEpoch() const
+	{
+		// bumped each time a new challenge comes in.
+		return m_challengeEpoch;
 	}
 
 public:
@@ -691,6 +1072,11 @@ private:
 
 	std::atomic<bool> m_isMining = {false};
 
+	// nonce allocation.  see nonceBase()
+	uint64_t m_rigPrefix;
+	bytes m_nonceChallenge;
+	std::unique_ptr<std::atomic<uint64_t>[]> m_nonceCursors;
+
 	friend class HashRates;
 	HashRates* m_hashRates;
 
@@ -701,6 +1087,8 @@ private:
 	HashFaultFn m_onHashFault;
 	// hash faults per miner for this session
 	std::vector<int> m_hashFaults;
+	// per miner, guarded by x_solutionStats
+	std::vector<StaleTimes> m_staleTimes;
 	uint64_t m_bestHash;
 	mutable SharedMutex x_bestHash;
 	mutable SharedMutex x_solutionStats;
@@ -710,9 +1098,15 @@ private:
 	// this includes work units
 	uint64_t m_lastCloseHit;
 
-	h256 solution;
-	int solutionMiner = -1;
-	mutable Mutex x_solution;
+	SolutionQueue m_solutions;
+	// when each recent challenge epoch began, and when the target last changed.  guarded by
+	// x_minerWork.
+	enum { c_epochHistory = 16 };
+	SteadyClock::time_point m_challengeChanged[c_epochHistory];
+	SteadyClock::time_point m_targetChanged;
+	SolutionQueuedFn m_onSolutionQueued;
+	Mutex x_onSolutionQueued;
+	std::atomic<unsigned> m_challengeEpoch = {0};
 
 }; 
 
@@ -0,0 +1,55 @@
+/*
+This file is part of mvis-ethereum.
+
+mvis-ethereum is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+mvis-ethereum is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with mvis-ethereum.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// 4-way keccak for KeccakMidstate.  this file is built with AVX2 enabled, so keep the includes
+// down to what is here (see KeccakLanes.h).
+
+#if ETH_KECCAK_AVX2 && defined(__AVX2__)
+
+#include <immintrin.h>
+#include "KeccakLanes.h"
+
+namespace
+{
+
+struct Lane256
+{
+	static const unsigned count = 4;
+	__m256i v;
+
+	static Lane256 set1(uint64_t _x) { return Lane256{_mm256_set1_epi64x((long long) _x)}; }
+	static Lane256 gids(uint64_t _gid)
+	{
+		return Lane256{_mm256_add_epi64(_mm256_set1_epi64x((long long) _gid), _mm256_set_epi64x(3, 2, 1, 0))};
+	}
+	friend Lane256 operator^(Lane256 _a, Lane256 _b) { return Lane256{_mm256_xor_si256(_a.v, _b.v)}; }
+	static Lane256 chi(Lane256 _a, Lane256 _b, Lane256 _c) { return Lane256{_mm256_xor_si256(_a.v, _mm256_andnot_si256(_b.v, _c.v))}; }
+	template <int N> static Lane256 rotl(Lane256 _a)
+	{
+		return Lane256{_mm256_or_si256(_mm256_slli_epi64(_a.v, N), _mm256_srli_epi64(_a.v, 64 - N))};
+	}
+	static void store(Lane256 _a, uint64_t* _out) { _mm256_storeu_si256((__m256i*) _out, _a.v); }
+};
+
+}
+
+void dev::eth::keccakUpper64AVX2(uint64_t const* _mid, uint64_t _gid, uint64_t* _out)
+{
+	keccakUpper64<Lane256>(_mid, _gid, _out);
+}
+
+#endif
@@ -0,0 +1,53 @@
+/*
+This file is part of mvis-ethereum.
+
+mvis-ethereum is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+mvis-ethereum is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with mvis-ethereum.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// 8-way keccak for KeccakMidstate.  this file is built with AVX-512F enabled, so keep the
+// includes down to what is here (see KeccakLanes.h).
+
+#if ETH_KECCAK_AVX512 && defined(__AVX512F__)
+
+#include <immintrin.h>
+#include "KeccakLanes.h"
+
+namespace
+{
+
+struct Lane512
+{
+	static const unsigned count = 8;
+	__m512i v;
+
+	static Lane512 set1(uint64_t _x) { return Lane512{_mm512_set1_epi64((long long) _x)}; }
+	static Lane512 gids(uint64_t _gid)
+	{
+		return Lane512{_mm512_add_epi64(_mm512_set1_epi64((long long) _gid), _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0))};
+	}
+	friend Lane512 operator^(Lane512 _a, Lane512 _b) { return Lane512{_mm512_xor_si512(_a.v, _b.v)}; }
+	// 0xd2 is the truth table for a ^ (~b & c)
+	static Lane512 chi(Lane512 _a, Lane512 _b, Lane512 _c) { return Lane512{_mm512_ternarylogic_epi64(_a.v, _b.v, _c.v, 0xd2)}; }
+	template <int N> static Lane512 rotl(Lane512 _a) { return Lane512{_mm512_rol_epi64(_a.v, N)}; }
+	static void store(Lane512 _a, uint64_t* _out) { _mm512_storeu_si512((void*) _out, _a.v); }
+};
+
+}
+
+void dev::eth::keccakUpper64AVX512(uint64_t const* _mid, uint64_t _gid, uint64_t* _out)
+{
+	keccakUpper64<Lane512>(_mid, _gid, _out);
+}
+
+#endif
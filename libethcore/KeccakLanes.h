@@ -0,0 +1,238 @@
+#pragma once
+
+/*
+This file is part of mvis-ethereum.
+
+mvis-ethereum is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+mvis-ethereum is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with mvis-ethereum.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// keccak rounds used by KeccakMidstate, written once over a lane type V so the same code serves
+// the scalar path and the SIMD paths (KeccakAVX2.cpp, KeccakAVX512.cpp).  V holds one 64-bit
+// state word per nonce being hashed, and must provide:
+//
+//		static const unsigned count;				number of nonces per V
+//		static V set1(uint64_t);					same value in every lane
+//		static V gids(uint64_t);					_gid, _gid + 1, ... _gid + count - 1
+//		V operator^(V, V);
+//		V chi(V a, V b, V c);						a ^ (~b & c)
+//		template <int N> V rotl(V);
+//		void store(V, uint64_t*);					writes count words
+//
+// the SIMD translation units are built with extra instruction set flags, so this header must
+// not pull in anything with inline functions of its own.  anything it instantiates has to be
+// keyed on a V that is local to the translation unit.
+
+#include <cstdint>
+
+namespace dev
+{
+namespace eth
+{
+
+static uint64_t const c_keccakRC[24] = {
+	0x0000000000000001ull, 0x0000000000008082ull, 0x800000000000808aull, 0x8000000080008000ull,
+	0x000000000000808bull, 0x0000000080000001ull, 0x8000000080008081ull, 0x8000000000008009ull,
+	0x000000000000008aull, 0x0000000000000088ull, 0x0000000080008009ull, 0x000000008000000aull,
+	0x000000008000808bull, 0x800000000000008bull, 0x8000000000008089ull, 0x8000000000008003ull,
+	0x8000000000008002ull, 0x8000000000000080ull, 0x000000000000800aull, 0x800000008000000aull,
+	0x8000000080008081ull, 0x8000000000008080ull, 0x0000000080000001ull, 0x8000000080008008ull
+};
+
+/*-----------------------------------------------------------------------------------
+* keccakFirstRound
+*----------------------------------------------------------------------------------*/
+// same as keccak_first_round in the OpenCL kernel: fold gid into the precomputed theta/rho/pi
+// state (see keccak_precomp), then do chi and iota.
+template <class V>
+inline void keccakFirstRound(V* state, uint64_t const* _mid, V gid)
+{
+	V mid[25];
+	for (unsigned i = 0; i < 25; i++)
+		mid[i] = V::set1(_mid[i]);
+
+	V C0, C1;
+
+	state[2] = mid[2] ^ V::template rotl<44>(gid);
+	state[4] = mid[4] ^ V::template rotl<14>(gid);
+
+	state[6] = mid[6] ^ V::template rotl<20>(gid);
+	state[9] = mid[9] ^ V::template rotl<62>(gid);
+
+	state[11] = mid[11] ^ V::template rotl<7>(gid);
+	state[13] = mid[13] ^ V::template rotl<8>(gid);
+
+	state[15] = mid[15] ^ V::template rotl<27>(gid);
+	state[18] = mid[18] ^ V::template rotl<16>(gid);
+
+	state[20] = mid[20] ^ V::template rotl<63>(gid);
+	state[21] = mid[21] ^ V::template rotl<55>(gid);
+	state[22] = mid[22] ^ V::template rotl<39>(gid);
+
+	state[0] = V::chi(mid[0], mid[1], state[2]) ^ V::set1(c_keccakRC[0]);
+	state[1] = V::chi(mid[1], state[2], mid[3]);
+	state[2] = V::chi(state[2], mid[3], state[4]);
+	state[3] = V::chi(mid[3], state[4], mid[0]);
+	state[4] = V::chi(state[4], mid[0], mid[1]);
+
+	C0 = state[6];
+	state[5] = V::chi(mid[5], C0, mid[7]);
+	state[6] = V::chi(C0, mid[7], mid[8]);
+	state[7] = V::chi(mid[7], mid[8], state[9]);
+	state[8] = V::chi(mid[8], state[9], mid[5]);
+	state[9] = V::chi(state[9], mid[5], C0);
+
+	C0 = state[11];
+	state[10] = V::chi(mid[10], C0, mid[12]);
+	state[11] = V::chi(C0, mid[12], state[13]);
+	state[12] = V::chi(mid[12], state[13], mid[14]);
+	state[13] = V::chi(state[13], mid[14], mid[10]);
+	state[14] = V::chi(mid[14], mid[10], C0);
+
+	C0 = state[15];
+	state[15] = V::chi(C0, mid[16], mid[17]);
+	state[16] = V::chi(mid[16], mid[17], state[18]);
+	state[17] = V::chi(mid[17], state[18], mid[19]);
+	state[18] = V::chi(state[18], mid[19], C0);
+	state[19] = V::chi(mid[19], C0, mid[16]);
+
+	C0 = state[20];
+	C1 = state[21];
+	state[20] = V::chi(C0, C1, state[22]);
+	state[21] = V::chi(C1, state[22], mid[23]);
+	state[22] = V::chi(state[22], mid[23], mid[24]);
+	state[23] = V::chi(mid[23], mid[24], C0);
+	state[24] = V::chi(mid[24], C0, C1);
+}
+
+/*-----------------------------------------------------------------------------------
+* keccakRound
+*----------------------------------------------------------------------------------*/
+template <class V>
+inline void keccakRound(V* state, unsigned r)
+{
+	V C[5], D;
+
+	C[0] = state[0] ^ state[5] ^ state[10] ^ state[15] ^ state[20];
+	C[1] = state[1] ^ state[6] ^ state[11] ^ state[16] ^ state[21];
+	C[2] = state[2] ^ state[7] ^ state[12] ^ state[17] ^ state[22];
+	C[3] = state[3] ^ state[8] ^ state[13] ^ state[18] ^ state[23];
+	C[4] = state[4] ^ state[9] ^ state[14] ^ state[19] ^ state[24];
+
+	for (unsigned x = 0; x < 5; x++)
+	{
+		D = V::template rotl<1>(C[(x + 1) % 5]) ^ C[(x + 4) % 5];
+		state[x] = state[x] ^ D;
+		state[x + 5] = state[x + 5] ^ D;
+		state[x + 10] = state[x + 10] ^ D;
+		state[x + 15] = state[x + 15] ^ D;
+		state[x + 20] = state[x + 20] ^ D;
+	}
+
+	// rho pi
+	C[0] = state[1];
+	state[1] = V::template rotl<44>(state[6]);
+	state[6] = V::template rotl<20>(state[9]);
+	state[9] = V::template rotl<61>(state[22]);
+	state[22] = V::template rotl<39>(state[14]);
+	state[14] = V::template rotl<18>(state[20]);
+	state[20] = V::template rotl<62>(state[2]);
+	state[2] = V::template rotl<43>(state[12]);
+	state[12] = V::template rotl<25>(state[13]);
+	state[13] = V::template rotl<8>(state[19]);
+	state[19] = V::template rotl<56>(state[23]);
+	state[23] = V::template rotl<41>(state[15]);
+	state[15] = V::template rotl<27>(state[4]);
+	state[4] = V::template rotl<14>(state[24]);
+	state[24] = V::template rotl<2>(state[21]);
+	state[21] = V::template rotl<55>(state[8]);
+	state[8] = V::template rotl<45>(state[16]);
+	state[16] = V::template rotl<36>(state[5]);
+	state[5] = V::template rotl<28>(state[3]);
+	state[3] = V::template rotl<21>(state[18]);
+	state[18] = V::template rotl<15>(state[17]);
+	state[17] = V::template rotl<10>(state[11]);
+	state[11] = V::template rotl<6>(state[7]);
+	state[7] = V::template rotl<3>(state[10]);
+	state[10] = V::template rotl<1>(C[0]);
+
+	// chi iota
+	for (unsigned y = 0; y < 25; y += 5)
+	{
+		C[0] = state[y + 0];
+		C[1] = state[y + 1];
+		state[y + 0] = V::chi(state[y + 0], state[y + 1], state[y + 2]);
+		state[y + 1] = V::chi(state[y + 1], state[y + 2], state[y + 3]);
+		state[y + 2] = V::chi(state[y + 2], state[y + 3], state[y + 4]);
+		state[y + 3] = V::chi(state[y + 3], state[y + 4], C[0]);
+		state[y + 4] = V::chi(state[y + 4], C[0], C[1]);
+	}
+	state[0] = state[0] ^ V::set1(c_keccakRC[r]);
+}
+
+/*-----------------------------------------------------------------------------------
+* keccakFinalRound
+*----------------------------------------------------------------------------------*/
+// only lane 0 of the output is needed, which depends on lanes 0, 6 and 12 after theta.
+template <class V>
+inline V keccakFinalRound(V const* state)
+{
+	V C[5];
+
+	C[0] = state[0] ^ state[5] ^ state[10] ^ state[15] ^ state[20];
+	C[1] = state[1] ^ state[6] ^ state[11] ^ state[16] ^ state[21];
+	C[2] = state[2] ^ state[7] ^ state[12] ^ state[17] ^ state[22];
+	C[3] = state[3] ^ state[8] ^ state[13] ^ state[18] ^ state[23];
+	C[4] = state[4] ^ state[9] ^ state[14] ^ state[19] ^ state[24];
+
+	V a0 = state[0] ^ V::template rotl<1>(C[1]) ^ C[4];
+	V a6 = state[6] ^ V::template rotl<1>(C[2]) ^ C[0];
+	V a12 = state[12] ^ V::template rotl<1>(C[3]) ^ C[1];
+
+	return V::chi(a0, V::template rotl<44>(a6), V::template rotl<43>(a12)) ^ V::set1(c_keccakRC[23]);
+}
+
+/*-----------------------------------------------------------------------------------
+* keccakUpper64
+*----------------------------------------------------------------------------------*/
+// hashes V::count consecutive gids starting at _gid, and writes the upper 64 bits of each hash
+// (byte swapped, so they can be compared with upper64OfHash(target)) to _out.
+template <class V>
+inline void keccakUpper64(uint64_t const* _mid, uint64_t _gid, uint64_t* _out)
+{
+	V state[25];
+	keccakFirstRound(state, _mid, V::gids(_gid));
+	for (unsigned r = 1; r < 23; r++)
+		keccakRound(state, r);
+	V::store(keccakFinalRound(state), _out);
+	for (unsigned i = 0; i < V::count; i++)
+	{
+		uint64_t x = _out[i];
+		x = ((x & 0x00000000ffffffffull) << 32) | ((x & 0xffffffff00000000ull) >> 32);
+		x = ((x & 0x0000ffff0000ffffull) << 16) | ((x & 0xffff0000ffff0000ull) >> 16);
+		x = ((x & 0x00ff00ff00ff00ffull) << 8) | ((x & 0xff00ff00ff00ff00ull) >> 8);
+		_out[i] = x;
+	}
+}
+
+// SIMD entry points, compiled only when the build could enable the instruction set
+// (see libethcore/CMakeLists.txt).  only call them after checking the CPU supports it.
+#if ETH_KECCAK_AVX2
+void keccakUpper64AVX2(uint64_t const* _mid, uint64_t _gid, uint64_t* _out);
+#endif
+#if ETH_KECCAK_AVX512
+void keccakUpper64AVX512(uint64_t const* _mid, uint64_t _gid, uint64_t* _out);
+#endif
+
+}
+}
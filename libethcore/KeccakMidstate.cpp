@@ -0,0 +1,159 @@
+/*
+This file is part of mvis-ethereum.
+
+mvis-ethereum is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+mvis-ethereum is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with mvis-ethereum.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "KeccakMidstate.h"
+#include "KeccakLanes.h"
+
+using namespace std;
+using namespace dev;
+using namespace eth;
+
+namespace
+{
+
+// one nonce at a time.  see KeccakLanes.h
+struct Lane64
+{
+	static const unsigned count = 1;
+	uint64_t v;
+
+	static Lane64 set1(uint64_t _x) { return Lane64{_x}; }
+	static Lane64 gids(uint64_t _gid) { return Lane64{_gid}; }
+	friend Lane64 operator^(Lane64 _a, Lane64 _b) { return Lane64{_a.v ^ _b.v}; }
+	static Lane64 chi(Lane64 _a, Lane64 _b, Lane64 _c) { return Lane64{_a.v ^ ((~_b.v) & _c.v)}; }
+	template <int N> static Lane64 rotl(Lane64 _a) { return Lane64{ROTL64(_a.v, N)}; }
+	static void store(Lane64 _a, uint64_t* _out) { *_out = _a.v; }
+};
+
+}
+
+/*-----------------------------------------------------------------------------------
+* KeccakMidstate
+*----------------------------------------------------------------------------------*/
+
+KeccakEngine KeccakMidstate::s_engine = KeccakEngine::Scalar;
+
+void KeccakMidstate::init(bytes const& _challenge, h160 const& _sender, h256 const& _nonce)
+{
+	uint64_t message[11];
+	memset(message, 0, sizeof(message));
+	memcpy(message, _challenge.data(), min<size_t>(_challenge.size(), 32));
+	memcpy((uint8_t*) message + 32, _sender.data(), 20);
+	memcpy((uint8_t*) message + 52, _nonce.data(), 32);
+	keccak_precomp(m_mid, message);
+	m_nonce = _nonce;
+}
+
+bool KeccakMidstate::setEngine(KeccakEngine _engine)
+{
+	switch (_engine)
+	{
+#if ETH_KECCAK_AVX2
+	case KeccakEngine::AVX2:
+#endif
+#if ETH_KECCAK_AVX512
+	case KeccakEngine::AVX512:
+#endif
+	case KeccakEngine::Scalar:
+		s_engine = _engine;
+		return true;
+	default:
+		return false;
+	}
+}
+
+unsigned KeccakMidstate::lanes()
+{
+	switch (s_engine)
+	{
+	case KeccakEngine::AVX2: return 4;
+	case KeccakEngine::AVX512: return 8;
+	default: return 1;
+	}
+}
+
+std::string KeccakMidstate::engineName()
+{
+	switch (s_engine)
+	{
+	case KeccakEngine::AVX2: return "AVX2";
+	case KeccakEngine::AVX512: return "AVX-512";
+	default: return "scalar";
+	}
+}
+
+uint64_t KeccakMidstate::hashUpper64(uint64_t _gid) const
+{
+	uint64_t upper;
+	keccakUpper64<Lane64>(m_mid, _gid, &upper);
+	return upper;
+}
+
+void KeccakMidstate::hashUpper64Lanes(uint64_t _gid, uint64_t* _out) const
+{
+	switch (s_engine)
+	{
+#if ETH_KECCAK_AVX2
+	case KeccakEngine::AVX2:
+		keccakUpper64AVX2(m_mid, _gid, _out);
+		break;
+#endif
+#if ETH_KECCAK_AVX512
+	case KeccakEngine::AVX512:
+		keccakUpper64AVX512(m_mid, _gid, _out);
+		break;
+#endif
+	default:
+		keccakUpper64<Lane64>(m_mid, _gid, _out);
+		break;
+	}
+}
+
+unsigned KeccakMidstate::search(uint64_t _gid, unsigned _count, uint64_t _upperTarget, uint64_t* _found, unsigned _maxFound) const
+{
+	unsigned lanes = KeccakMidstate::lanes();
+	unsigned found = 0;
+	uint64_t upper[8];
+	uint64_t gid = _gid, end = _gid + _count;
+	for (; end - gid >= lanes; gid += lanes)
+	{
+		hashUpper64Lanes(gid, upper);
+		for (unsigned i = 0; i < lanes; i++)
+			if (upper[i] <= _upperTarget)
+			{
+				if (found < _maxFound)
+					_found[found] = gid + i;
+				found++;
+			}
+	}
+	// whatever doesn't fill a lane group, one at a time.
+	for (; gid != end; gid++)
+		if (hashUpper64(gid) <= _upperTarget)
+		{
+			if (found < _maxFound)
+				_found[found] = gid;
+			found++;
+		}
+	return found;
+}
+
+h256 KeccakMidstate::nonce(uint64_t _gid) const
+{
+	h256 n = m_nonce;
+	memcpy(n.data() + 12, &_gid, 8);
+	return n;
+}
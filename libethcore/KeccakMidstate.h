@@ -0,0 +1,140 @@
+#pragma once
+
+/*
+This file is part of mvis-ethereum.
+
+mvis-ethereum is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+mvis-ethereum is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with mvis-ethereum.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <libdevcore/FixedHash.h>
+
+#define ROTL64(x, y) (((x) << (y)) ^ ((x) >> (64 - (y))))
+
+namespace dev
+{
+namespace eth
+{
+
+/*-----------------------------------------------------------------------------------
+* keccak_precomp
+*----------------------------------------------------------------------------------*/
+
+// the 0xBitcoin message is challenge (32 bytes) + sender (20 bytes) + nonce (32 bytes). this
+// computes theta, rho and pi of the first keccak round over that message, with lane 8 (nonce
+// bytes 12..19) taken to be zero. the miners fold the real value of lane 8 in afterwards, which
+// is cheap because theta is linear.  message must point to 11 lanes (88 bytes, zero padded).
+// the result is also what the OpenCL kernel expects in its g_preCompute buffer.
+
+inline void keccak_precomp(uint64_t* mid, uint64_t const* message)
+{
+	uint64_t C[4], D[5];
+	C[0] = message[0] ^ message[5] ^ message[10] ^ 0x100000000ull;
+	C[1] = message[1] ^ message[6] ^ 0x8000000000000000ull;
+	C[2] = message[2] ^ message[7];
+	C[3] = message[4] ^ message[9];
+
+	D[0] = ROTL64(C[1], 1) ^ C[3];
+	D[1] = ROTL64(C[2], 1) ^ C[0];
+	D[2] = ROTL64(message[3], 1) ^ C[1];
+	D[3] = ROTL64(C[3], 1) ^ C[2];
+	D[4] = ROTL64(C[0], 1) ^ message[3];
+
+	mid[0] = message[0] ^ D[0];
+	mid[1] = ROTL64(message[6] ^ D[1], 44);
+	mid[2] = ROTL64(D[2], 43);
+	mid[3] = ROTL64(D[3], 21);
+	mid[4] = ROTL64(D[4], 14);
+	mid[5] = ROTL64(message[3] ^ D[3], 28);
+	mid[6] = ROTL64(message[9] ^ D[4], 20);
+	mid[7] = ROTL64(message[10] ^ D[0] ^ 0x100000000ull, 3);
+	mid[8] = ROTL64(0x8000000000000000ull ^ D[1], 45);
+	mid[9] = ROTL64(D[2], 61);
+	mid[10] = ROTL64(message[1] ^ D[1], 1);
+	mid[11] = ROTL64(message[7] ^ D[2], 6);
+	mid[12] = ROTL64(D[3], 25);
+	mid[13] = ROTL64(D[4], 8);
+	mid[14] = ROTL64(D[0], 18);
+	mid[15] = ROTL64(message[4] ^ D[4], 27);
+	mid[16] = ROTL64(message[5] ^ D[0], 36);
+	mid[17] = ROTL64(D[1], 10);
+	mid[18] = ROTL64(D[2], 15);
+	mid[19] = ROTL64(D[3], 56);
+	mid[20] = ROTL64(message[2] ^ D[2], 62);
+	mid[21] = ROTL64(D[3], 55);
+	mid[22] = ROTL64(D[4], 39);
+	mid[23] = ROTL64(D[0], 41);
+	mid[24] = ROTL64(D[1], 2);
+}
+
+
+/*-----------------------------------------------------------------------------------
+* class KeccakMidstate
+*----------------------------------------------------------------------------------*/
+
+// CPU implementation of keccak256_0xBitcoin() for mining. challenge and sender don't change
+// during a work package, so the first round is precomputed once, and each hash only has to
+// fold in the nonce-dependent lanes.  the nonce being searched lives in bytes 12..19 of the
+// full nonce (lane 8 of the message), which is where the OpenCL kernel puts its work item id.
+
+enum class KeccakEngine
+{
+	Scalar,
+	AVX2,		// 4 nonces per call
+	AVX512		// 8 nonces per call
+};
+
+class KeccakMidstate
+{
+public:
+
+	// selects the implementation used by hashUpper64Lanes for all instances.  returns false
+	// (and leaves the current one in place) if it was not compiled in.  this does not check
+	// what the CPU supports, that is up to the caller.
+	static bool setEngine(KeccakEngine _engine);
+	static KeccakEngine engine() { return s_engine; }
+	static std::string engineName();
+
+	// number of nonces hashed by each call to hashUpper64Lanes.
+	static unsigned lanes();
+
+	// _nonce supplies bytes 0..11 and 20..31 of the nonce. bytes 12..19 are ignored.
+	void init(bytes const& _challenge, h160 const& _sender, h256 const& _nonce);
+
+	// returns the upper 64 bits of the hash of the message whose nonce bytes 12..19 are _gid.
+	// the result can be compared directly with upper64OfHash(target).  only lane 0 of the final
+	// round is computed, so this cannot be used to obtain the full hash.
+	uint64_t hashUpper64(uint64_t _gid) const;
+
+	// same as hashUpper64, but for the lanes() consecutive gids starting at _gid, using the
+	// selected engine.  _out must have room for lanes() values.
+	void hashUpper64Lanes(uint64_t _gid, uint64_t* _out) const;
+
+	// hashes _count consecutive gids starting at _gid, lanes() at a time where it can. the gids
+	// whose upper 64 bits are at or below _upperTarget are written to _found, up to _maxFound of
+	// them.  a tie on the upper 64 bits is only a candidate: the caller checks the full hash.
+	// returns the number of candidates seen, which may be more than _maxFound.
+	unsigned search(uint64_t _gid, unsigned _count, uint64_t _upperTarget, uint64_t* _found, unsigned _maxFound) const;
+
+	// returns the full nonce corresponding to _gid.
+	h256 nonce(uint64_t _gid) const;
+
+private:
+	uint64_t m_mid[25];
+	h256 m_nonce;
+
+	static KeccakEngine s_engine;
+};
+
+}
+}
@@ -108,15 +108,21 @@ public:
 
 	void acceptedStale() { acceptedStales++; }
 	void rejectedStale() { rejectedStales++; }
+	// found by a device, but more than its results buffer could hold
+	void lost(unsigned _count) { losts += _count; }
+	// found for work we had moved on from by the time it got to the main loop, so not sent
+	void dropped() { drops++; }
 
 
-	void reset() { accepts = rejects = failures = acceptedStales = rejectedStales = 0; }
+	void reset() { accepts = rejects = failures = acceptedStales = rejectedStales = losts = drops = 0; }
 
 	unsigned getAccepts()			{ return accepts; }
 	unsigned getRejects()			{ return rejects; }
 	unsigned getFailures()			{ return failures; }
 	unsigned getAcceptedStales()	{ return acceptedStales; }
 	unsigned getRejectedStales()	{ return rejectedStales; }
+	unsigned getLost()				{ return losts; }
+	unsigned getDropped()			{ return drops; }
 private:
 	unsigned accepts  = 0;
 	unsigned rejects  = 0;
@@ -124,6 +130,8 @@ private:
 
 	unsigned acceptedStales = 0;
 	unsigned rejectedStales = 0;
+	unsigned losts = 0;
+	unsigned drops = 0;
 
 };	 // class SolutionStats
 
@@ -131,16 +139,160 @@ private:
 
 inline std::ostream& operator<<(std::ostream& os, SolutionStats s)
 {
-	return os << "[A" << s.getAccepts() << "+" << s.getAcceptedStales() << ":R" << s.getRejects() << "+" << s.getRejectedStales() << ":F" << s.getFailures() << "]";
+	return os << "[A" << s.getAccepts() << "+" << s.getAcceptedStales() << ":R" << s.getRejects() << "+" << s.getRejectedStales() << ":F" << s.getFailures() << ":L" << s.getLost() << ":D" << s.getDropped() << "]";
 }
 
 
+/*-----------------------------------------------------------------------------------
+* class StaleTimes
+*----------------------------------------------------------------------------------*/
+
+// histogram of when a device found its stale solutions, relative to the work change that made
+// them stale.  "before" means the solution was still on its way (being verified, queued or
+// submitted) when the work moved on.  anything after means the device was still hashing the
+// old work.
+
+class StaleTimes {
+public:
+	enum { c_buckets = 6 };
+
+	void record(int64_t _ms)
+	{
+		static const int64_t limits[c_buckets - 1] = {0, 100, 500, 1000, 5000};
+		unsigned b = 0;
+		while (b < c_buckets - 1 && _ms >= limits[b])
+			b++;
+		counts[b]++;
+	}
+
+	unsigned get(unsigned _bucket) const { return counts[_bucket]; }
+
+	static char const* label(unsigned _bucket)
+	{
+		static char const* const labels[c_buckets] = {"before", "<100ms", "<500ms", "<1s", "<5s", ">=5s"};
+		return labels[_bucket];
+	}
+
+private:
+	unsigned counts[c_buckets] = {0};
+
+};	// class StaleTimes
+
+
+inline std::ostream& operator<<(std::ostream& os, StaleTimes const& s)
+{
+	// only the buckets that have something in them
+	std::string sep;
+	for (unsigned b = 0; b < StaleTimes::c_buckets; b++)
+		if (s.get(b))
+		{
+			os << sep << StaleTimes::label(b) << ":" << s.get(b);
+			sep = " ";
+		}
+	return os;
+}
+
+
+/*-----------------------------------------------------------------------------------
+* struct DeviceStats
+*----------------------------------------------------------------------------------*/
+
+// device side timings, from miners that can measure them (OpenCL event profiling).
+// averaged over the last couple of seconds.
+struct DeviceStats
+{
+	double busy = 0;		// percent of the time a kernel was running
+	double gapMs = 0;		// idle time between one kernel ending and the next starting
+	double latencyMs = 0;	// time from a kernel being queued to it starting
+	double hashRate = 0;	// MH/s while a kernel was running
+};
+
+
 template <class PoW> class GenericMiner;
 
 template <class PoW> class GenericFarm;
 
 
 
+/*-----------------------------------------------------------------------------------
+* class SolutionQueue
+*----------------------------------------------------------------------------------*/
+
+struct SolutionRecord
+{
+	h256 nonce;
+	int miner;
+	unsigned epoch;					// GenericFarm::challengeEpoch() of the work it was found for
+	h256 target;					// target of the work it was found for
+	SteadyClock::time_point found;
+};
+
+// solutions on their way from the miners to the main loop.  any number of miners can push at
+// once without locking, and the main loop pops them.  it's a ring of fixed size where each cell
+// carries a sequence number saying whether it is free for the push at that position or holds
+// the value for the pop at that position.  push() fails rather than blocks when it's full.
+
+class SolutionQueue
+{
+public:
+
+	SolutionQueue()
+	{
+		for (unsigned i = 0; i < c_size; i++)
+			m_cells[i].seq.store(i, std::memory_order_relaxed);
+	}
+
+	bool push(SolutionRecord const& _solution)
+	{
+		uint64_t pos = m_tail.load(std::memory_order_relaxed);
+		while (true)
+		{
+			Cell& cell = m_cells[pos & c_mask];
+			int64_t diff = int64_t(cell.seq.load(std::memory_order_acquire)) - int64_t(pos);
+			if (diff == 0)
+			{
+				if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					cell.value = _solution;
+					cell.seq.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+				return false;
+			else
+				pos = m_tail.load(std::memory_order_relaxed);
+		}
+	}
+
+	// single consumer only.
+	bool pop(SolutionRecord& _solution)
+	{
+		Cell& cell = m_cells[m_head & c_mask];
+		if (int64_t(cell.seq.load(std::memory_order_acquire)) - int64_t(m_head + 1) < 0)
+			return false;
+		_solution = cell.value;
+		cell.seq.store(m_head + c_size, std::memory_order_release);
+		m_head++;
+		return true;
+	}
+
+private:
+	enum { c_size = 256, c_mask = c_size - 1 };
+
+	struct Cell
+	{
+		std::atomic<uint64_t> seq;
+		SolutionRecord value;
+	};
+
+	Cell m_cells[c_size];
+	std::atomic<uint64_t> m_tail = {0};
+	uint64_t m_head = 0;
+
+};	// class SolutionQueue
+
+
 /*-----------------------------------------------------------------------------------
 * class PIDController
 *----------------------------------------------------------------------------------*/
@@ -256,8 +408,10 @@ public:
 	using Farm = GenericFarm<PoW>;
 
 
-	GenericMiner(Farm* _farm, unsigned _index):
-		m_farm(_farm), m_index(_index), m_pidController(*this)
+	// _index is the miner's place in the farm, _instance its place among miners of its own kind,
+	// which can differ when a farm mixes CPU and GPU miners.
+	GenericMiner(Farm* _farm, unsigned _index, unsigned _instance):
+		m_farm(_farm), m_index(_index), m_instance(_instance), m_pidController(*this)
 	{
 		m_tempSource = ProgOpt::Get("ThermalProtection", "TempProvider", "amd_adl");
 		LowerCase(m_tempSource);
@@ -278,19 +432,20 @@ public:
 			Guard l(x_work);
 			challenge = _challenge;
 			target = _target;
+			// the farm bumps its epoch before handing out a new challenge.
+			m_challengeEpoch = m_farm ? m_farm->challengeEpoch() : 0;
+			m_workEpoch++;
 		}
 		if (!_challenge.empty()) {
-			DEV_TIMED_ABOVE("pause", 250)
-				pause();
-			DEV_TIMED_ABOVE("kickOff", 250)
-				kickOff();
+			if (!swapWork()) {
+				DEV_TIMED_ABOVE("pause", 250)
+					pause();
+				DEV_TIMED_ABOVE("kickOff", 250)
+					kickOff();
+			}
 		} else if (_challenge.empty() && !old.empty())
 			pause();
 
-		if (m_index == 0)
-			// clear out the nonces. only one miner needs to do this.
-			storeNonceIndex(0, true);
-
 		//  we'll use this as a convenient place to recalculate our work unit threshold periodically
 		calcWorkUnitThreshold();
 	}
@@ -317,13 +472,14 @@ public:
 
 
 	/**
-	*   @brief Get the hash rate.
+	*   @brief Hashes done so far, for the farm's hash rate sampler.  Lock-free.
+	*   @param _restart set if the count shouldn't be compared with the previous sample (new 
+	*   work, see accumulateHashes).
 	*/
-	double getHashRate()
+	uint64_t hashesDone(bool& _restart)
 	{
-		ReadGuard l(x_hashRates);
-		LogF << "Trace: GenericMiner::getHashRate, miner = " << m_index << ", hashRate = " << m_hashRate.value();
-		return m_hashRate.value();
+		_restart = m_hashSampleReset.exchange(false, std::memory_order_relaxed);
+		return m_hashesDone.value.load(std::memory_order_relaxed);
 	}
 
 	uint64_t currentHash() 
@@ -359,6 +515,23 @@ public:
 		return m_bestHash; 
 	}
 
+	/**
+	*   @brief Miner found a hash below its close hit threshold.  passed on to the farm along
+	*   with the number of seconds since the previous one.
+	*/
+	void closeHit(uint64_t _hash)
+	{
+		SteadyClock::time_point now = SteadyClock::now();
+		unsigned work = std::chrono::duration_cast<std::chrono::seconds>(now - m_lastCloseHit).count();
+		m_lastCloseHit = now;
+		m_farm->reportCloseHit(_hash, work, m_index);
+	}
+
+	uint64_t closeHitThreshold() const
+	{
+		return m_closeHit;
+	}
+
 	virtual void resetBestHash() 
 	{ 
 		WriteGuard l(x_hashVal); 
@@ -370,9 +543,20 @@ public:
 		return m_index; 
 	}
 
+	unsigned instance() const 
+	{ 
+		return m_instance; 
+	}
+
+	// false for miners without a temperature / fan sensor of their own (CPU threads).
+	virtual bool hasSensors() const { return true; }
+
 	// functionality implemented in descendant classes.
 	virtual void setThrottle(int _percent) { }
 
+	// fills in _stats and returns true if the miner measures its device timings.
+	virtual bool deviceStats(DeviceStats& _stats) { return false; }
+
 	int throttle(void) 
 	{ 
 		return m_throttle; 
@@ -380,12 +564,14 @@ public:
 
 	double gpuTemp(void)
 	{
+		if (!hasSensors())
+			return 0;
 		if (m_tempSource == TEMP_SOURCE_SPEEDFAN)
 		{
 			#ifdef _WIN32
 			std::vector<double> data;
-			g_SpeedFan.getData(data, SpeedFan::Temperatures, m_index + 1);
-			return data.size() > m_index ? data[m_index] : 0;
+			g_SpeedFan.getData(data, SpeedFan::Temperatures, m_instance + 1);
+			return data.size() > m_instance ? data[m_instance] : 0;
 			#else
 			return 0;
 			#endif
@@ -407,6 +593,8 @@ public:
 
 	int fanSpeed(void)
 	{
+		if (!hasSensors())
+			return 0;
 		return g_ADLUtils.getFanSpeed(m_device);
 	}
 
@@ -420,65 +608,30 @@ public:
 	}
 
 
-	bool storeNonceIndex(uint64_t _nonceIndex, bool _clear = false)
+	/**
+	* @brief record # of hashes computed.  safe to call from the mining thread at any rate,
+	* it only bumps an atomic counter.  the farm's hash rate sampler works out the rate.
+	*/
+	void addHashes(uint64_t _n)
 	{
-		// when nonces are being generated randomly, we keep track of which ones
-		// have been searched so as to avoid repetition.  s_usedNonces is static so
-		// it is shared across all miners.
-		static set<unsigned> s_usedNonces;
-		static dev::SpinLock x_nonces;
-		dev::SpinGuard l(x_nonces);
-		if (_clear)
-		{
-			s_usedNonces.clear();
-			return true;
-		}
-		else
-		{
-			// return true if this nonce index has not already been stored.
-			auto result = s_usedNonces.insert(_nonceIndex);
-			return result.second;
-		}
+		m_hashesDone.value.fetch_add(_n, std::memory_order_relaxed);
 	}
 
-	// member element in m_recentHashes
-	typedef struct
-	{
-		SystemClock::time_point t;
-		int hashes;
-	} hashRec_t;
-
 	/**
-	* @brief record # of hashes computed.
+	* @brief record # of hashes computed, for miners that report per kernel batch.
 	*/
-	void accumulateHashes(unsigned _n, int _batchCount)
+	void accumulateHashes(uint64_t _n, int _batchCount)
 	{
-
 		if (_batchCount < 2)
 		{
 			// we ignore the first few batches.  when cl_miner.search() starts out, after a new
 			// work package has arrived, it experiences an extra delay because it has to wait for 
 			// the last kernel run from the previous work package to finish.
-			m_hashCount = 0;
-			m_hashTimer.restart();
+			m_hashSampleReset.store(true, std::memory_order_relaxed);
 			return;
 		}
-		m_hashCount += _n;
-		uint64_t elapsed = m_hashTimer.elapsedMicroseconds();
-		// we'll accumulate hashes for awhile and then update our exponential moving average.
-		if (elapsed / 1000 > 700)
-		{
-			double batchRate = (double) m_hashCount / elapsed;
-			m_hashRate.newVal(batchRate);
-			m_hashCount = 0;
-			m_hashTimer.restart();
-			LogF << "accumulateHashes.update: batch rate = " << batchRate << ", hash rate = " << m_hashRate.value();
-		}
-		else
-		{
-			LogF << "accumulateHashes.accumulate: hashes = " << m_hashCount << ", time = " << elapsed / 1000;
-		}
-	}	// accumulateHashes
+		addHashes(_n);
+	}
 
 public:
 	GenericFarm<PoW>* m_farm = nullptr;
@@ -499,6 +652,37 @@ protected:
 	 */
 	virtual void pause() = 0;
 
+	// OPTIONAL:
+
+	/**
+	 * @brief Switch to the new work package without stopping.  Miners that can do this watch
+	 * m_workEpoch and pick up the new work with currentWork().
+	 * @return false to have setWork() do pause() and kickOff() instead.
+	 */
+	virtual bool swapWork() { return false; }
+
+	/**
+	 * @brief Take a consistent copy of the current work.
+	 * @return the work epoch the copy belongs to.
+	 */
+	unsigned currentWork(bytes& _challenge, h256& _target) const
+	{
+		unsigned challengeEpoch;
+		return currentWork(_challenge, _target, challengeEpoch);
+	}
+
+	/**
+	 * @brief Same, also giving the GenericFarm::challengeEpoch() of the copy's challenge.
+	 */
+	unsigned currentWork(bytes& _challenge, h256& _target, unsigned& _challengeEpoch) const
+	{
+		Guard l(x_work);
+		_challenge = challenge;
+		_target = target;
+		_challengeEpoch = m_challengeEpoch;
+		return m_workEpoch;
+	}
+
 	/**
 	 * @brief Notes that the Miner found a solution.
 	 * @param _s The solution.
@@ -528,9 +712,17 @@ protected:
 		LogF << "Trace: GenericMiner::submitProof, miner[" << m_index << "]";
 		if (!m_farm)
 			return true;
-		if (m_farm->submitProof(_nonce, this)) {
+		unsigned epoch;
+		h256 l_target;
+		{
+			Guard l(x_work);
+			epoch = m_challengeEpoch;
+			l_target = target;
+		}
+		if (m_farm->submitProof(_nonce, this, epoch, l_target)) {
 			Guard l(x_work);
 			challenge.clear();
+			m_workEpoch++;
 			return true;
 		}
 		return false;
@@ -549,20 +741,31 @@ protected:
 	static volatile void* s_dagInHostMemory;
 	int m_throttle = 0;
 	unsigned m_index;		// zero-based
-	unsigned m_device;
+	unsigned m_instance;	// zero-based, among miners of the same kind
+	unsigned m_device = 0;
 
 	h256 target;
 	bytes challenge;
 
+	// bumped whenever the work changes.
+	std::atomic<unsigned> m_workEpoch = {0};
+	// GenericFarm::challengeEpoch() of the current work, for tagging solutions.
+	unsigned m_challengeEpoch = 0;
+
 private:
 
-	uint64_t m_hashCount = 0;
-	Timer m_hashTimer;
-	mutable SharedMutex x_hashRates;
-	EMA m_hashRate = EMA(4);
-	// start time of hash rate accumulation period
-	SteadyClock::time_point m_hashPeriodStart;
-	bool m_hashRatePaused = true;
+	// written by the mining thread, read by the hash rate sampler.  padded a full cache line on
+	// both sides so the mining thread isn't fighting over it with its neighbours.  explicit
+	// padding rather than alignas, since miners come from plain new, which under C++11 doesn't
+	// honour over-alignment.
+	struct HashCounter
+	{
+		char before[64];
+		std::atomic<uint64_t> value = {0};
+		char after[64 - sizeof(std::atomic<uint64_t>)];
+	};
+	HashCounter m_hashesDone;
+	std::atomic<bool> m_hashSampleReset = {true};
 
 	WorkPackage m_work;
 	mutable Mutex x_work;
@@ -269,6 +269,9 @@ void EthStratumClient::processReponse(Json::Value& responseObject)
 				m_target = u256(responseObject["params"][1].asString());
 				m_difficulty = atoll(responseObject["params"][2].asString().c_str());
 				m_hashingAcct = responseObject["params"][3].asString();
+				// under the lock, so the handler can't be swapped out from under us.
+				if (m_onWork)
+					m_onWork();
 			} 
 			else
 			{
@@ -352,6 +355,12 @@ void EthStratumClient::getWork(bytes& _challenge, h256& _target, uint64_t& _diff
 	_hashingAcct = m_hashingAcct;
 }
 
+void EthStratumClient::onWork(NewWorkFn const& _handler)
+{
+	Guard l(x_work);
+	m_onWork = _handler;
+}
+
 bool EthStratumClient::isRunning() 
 { 
 	return m_running; 
@@ -40,6 +40,7 @@ class EthStratumClient
 public:
 
 	using WorkPackageFn = std::function<void(unsigned int)>;
+	using NewWorkFn = std::function<void()>;
 
 	EthStratumClient(
 		string const & url, 
@@ -56,6 +57,8 @@ public:
 	void getWork(bytes& _challenge, h256& _target, uint64_t& _difficulty, string& _hashingAcct);
 	void disconnect();
 	void switchAcct(string _newAcct);
+	// called on the stratum thread each time the pool sends work.  it should only hand off.
+	void onWork(NewWorkFn const& _handler);
 
 private:
 	void connectStratum();
@@ -101,4 +104,5 @@ private:
 	std::string m_shareAcct;
 
 	Mutex x_work;
+	NewWorkFn m_onWork;
 };
\ No newline at end of file